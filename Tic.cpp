@@ -1,235 +1,1317 @@
 #include <Tic.h>
 #include <Arduino.h>
 
-static const uint16_t Tic03aCurrentTable[33] =
-{
-  0,
-  1,
-  174,
-  343,
-  495,
-  634,
-  762,
-  880,
-  990,
-  1092,
-  1189,
-  1281,
-  1368,
-  1452,
-  1532,
-  1611,
-  1687,
-  1762,
-  1835,
-  1909,
-  1982,
-  2056,
-  2131,
-  2207,
-  2285,
-  2366,
-  2451,
-  2540,
-  2634,
-  2734,
-  2843,
-  2962,
-  3093,
-};
+constexpr uint16_t TicCurrentLimit<TicProduct::T500>::table[];
 
 void TicBase::setCurrentLimit(uint16_t limit)
 {
-  uint8_t code = 0;
+  uint8_t code;
+  switch (product)
+  {
+  case TicProduct::T500:
+    code = TicCurrentLimit<TicProduct::T500>::toCode(limit);
+    break;
+  case TicProduct::T249:
+    code = TicCurrentLimit<TicProduct::T249>::toCode(limit);
+    break;
+  case TicProduct::Tic36v4:
+    code = TicCurrentLimit<TicProduct::Tic36v4>::toCode(limit);
+    break;
+  default:
+    code = TicCurrentLimit<TicProduct::T825>::toCode(limit);
+    break;
+  }
+  setCurrentLimitCode(code);
+}
+
+uint16_t TicBase::getCurrentLimit()
+{
+  return currentLimitFromCode(getCurrentLimitCode());
+}
+
+uint16_t TicBase::currentLimitFromCode(TicProduct product, uint8_t code)
+{
+  switch (product)
+  {
+  case TicProduct::T500:
+    return TicCurrentLimit<TicProduct::T500>::fromCode(code);
+  case TicProduct::T249:
+    return TicCurrentLimit<TicProduct::T249>::fromCode(code);
+  case TicProduct::Tic36v4:
+    return TicCurrentLimit<TicProduct::Tic36v4>::fromCode(code);
+  default:
+    return TicCurrentLimit<TicProduct::T825>::fromCode(code);
+  }
+}
+
+void TicBase::sendQuick(TicCommand cmd)
+{
+  commandQuick(cmd);
+  if (_shadow) { _shadow->commandSent(cmd, 0, _lastError); }
+}
+
+void TicBase::sendW32(TicCommand cmd, uint32_t val)
+{
+  if (_shadow && _shadow->isRedundant(cmd, val, _lastCommandTime))
+  {
+    _lastError = 0;
+    return;
+  }
+  commandW32(cmd, val);
+  if (_shadow) { _shadow->commandSent(cmd, val, _lastError); }
+}
+
+void TicBase::sendW7(TicCommand cmd, uint8_t val)
+{
+  if (_shadow && _shadow->isRedundant(cmd, val, _lastCommandTime))
+  {
+    _lastError = 0;
+    return;
+  }
+  commandW7(cmd, val);
+  if (_shadow) { _shadow->commandSent(cmd, val, _lastError); }
+}
+
+void TicBase::sendCommand(TicCommand cmd, uint32_t val)
+{
+  // The upper bits of the command byte determine the format of its data.
+  switch ((uint8_t)cmd & 0xF0)
+  {
+  case 0xE0:
+    sendW32(cmd, val);
+    break;
+  case 0x90:
+    sendW7(cmd, val);
+    break;
+  case 0xA0:
+    break;
+  default:
+    if (cmd == TicCommand::Reset) { reset(); }
+    else { sendQuick(cmd); }
+    break;
+  }
+}
+
+void TicBase::getVariables(TicVariables & vars)
+{
+  uint8_t buffer[TicVariablesSize];
+  readBlock(TicCommand::GetVariable, 0, TicVariablesSize, buffer);
+  decodeVariables(buffer, vars);
+  if (_shadow && _lastError == 0)
+  {
+    _shadow->noteDeviceReset((uint8_t)vars.deviceReset);
+    _shadow->noteUpTime(vars.upTime);
+  }
+}
 
-  if (product == TicProduct::T500)
+void TicBase::getVariables(TicVariables & vars, TicVariableMask mask,
+  uint8_t gap)
+{
+  uint8_t buffer[TicVariablesSize];
+  memset(buffer, 0, sizeof(buffer));
+  TicVariableMask fetched = readVariables(mask, gap, buffer);
+  decodeVariables(buffer, vars);
+  if (_shadow)
   {
-    for (uint8_t i = 0; i < 33; i++)
+    if (fetched & ticVariableBit(TicVariable::DeviceReset))
     {
-      if (Tic03aCurrentTable[i] <= limit)
-      {
-        code = i;
-      }
-      else
-      {
-        break;
-      }
+      _shadow->noteDeviceReset((uint8_t)vars.deviceReset);
+    }
+    if (fetched & ticVariableBit(TicVariable::UpTime))
+    {
+      _shadow->noteUpTime(vars.upTime);
+    }
+  }
+}
+
+// Reads the variables in the mask into the buffer, which is laid out like the
+// Tic's variables.  Returns a mask of the variables that were read
+// successfully, including any unrequested ones that were read along with
+// them.
+TicVariableMask TicBase::readVariables(TicVariableMask mask, uint8_t gap,
+  uint8_t * buffer)
+{
+  TicVariableMask fetched = 0;
+
+  uint8_t first = TicReadPlanner::next(mask, 0);
+  while (first < TicVariableCount)
+  {
+    uint8_t last = first;
+    uint8_t candidate = TicReadPlanner::next(mask, last + 1);
+    while (TicReadPlanner::extends(first, last, candidate, gap))
+    {
+      last = candidate;
+      candidate = TicReadPlanner::next(mask, last + 1);
+    }
+
+    uint8_t offset = TicReadPlanner::offsets[first];
+    readBlock(TicCommand::GetVariable, offset,
+      TicReadPlanner::end(last) - offset, buffer + offset);
+    if (_lastError) { break; }
+
+    for (uint8_t i = first; i <= last; i++)
+    {
+      fetched |= (TicVariableMask)1 << i;
     }
+
+    first = candidate;
+  }
+
+  return fetched;
+}
+
+void TicBase::getCachedVar(uint8_t offset, uint8_t length, void * buffer)
+{
+  TicVariableCache * cache = _cache;
+
+  // Find the variable at this offset.  The offsets are sorted, so we use a
+  // binary search.
+  uint8_t low = 0, high = TicVariableCount - 1;
+  while (low < high)
+  {
+    uint8_t middle = (low + high + 1) / 2;
+    if (TicReadPlanner::offsets[middle] <= offset) { low = middle; }
+    else { high = middle - 1; }
   }
-  else if (product == TicProduct::T249)
+  uint8_t index = low;
+
+  uint32_t now = millis();
+  bool fresh = (cache->valid >> index & 1) &&
+    (uint32_t)(now - cache->readTimes[index]) <= cache->maxAge;
+
+  if (fresh)
   {
-    code = limit / TicT249CurrentUnits;
+    cache->hits++;
+    _lastError = 0;
   }
-  else if (product == TicProduct::Tic36v4)
+  else
   {
-    if (limit < 72) { code = 0; }
-    else if (limit >= 9095) { code = 127; }
-    else
+    cache->misses++;
+
+    // Refresh this variable along with every stale variable in the prefetch
+    // mask.
+    TicVariableMask stale = (TicVariableMask)1 << index;
+    for (uint8_t i = 0; i < TicVariableCount; i++)
     {
-      code = ((uint32_t)limit * 768 - 55000 / 2) / 55000;
-      if (code < 127 && (((uint32_t)55000 * (code + 1) + 384) / 768) <= limit)
+      if ((cache->prefetchMask >> i & 1) && (!(cache->valid >> i & 1) ||
+        (uint32_t)(now - cache->readTimes[i]) > cache->maxAge))
       {
-        code++;
+        stale |= (TicVariableMask)1 << i;
       }
     }
+
+    TicVariableMask fetched =
+      readVariables(stale, TicDefaultReadGap, cache->data);
+    for (uint8_t i = 0; i < TicVariableCount; i++)
+    {
+      if (fetched >> i & 1) { cache->readTimes[i] = now; }
+    }
+    cache->valid |= fetched;
+
+    if (!(fetched >> index & 1))
+    {
+      // Set the buffer bytes to 0 so the program will not use an
+      // uninitialized variable.
+      memset(buffer, 0, length);
+      return;
+    }
   }
-  else
+
+  memcpy(buffer, cache->data + offset, length);
+}
+
+void TicBase::readRanges(const TicReadRange * ranges, uint8_t count,
+  uint8_t * buffer)
+{
+  memset(buffer, 0, TicVariablesSize);
+  for (uint8_t i = 0; i < count; i++)
   {
-    code = limit / TicCurrentUnits;
+    readBlock(TicCommand::GetVariable, ranges[i].offset, ranges[i].length,
+      buffer + ranges[i].offset);
+    if (_lastError) { break; }
   }
+}
 
-  commandW7(TicCommand::SetCurrentLimit, code);
+void TicBase::readBlock(TicCommand cmd, uint8_t offset, uint8_t length,
+  void * buffer)
+{
+  uint8_t * ptr = (uint8_t *)buffer;
+  uint8_t limit = maxSegmentLength();
+  _lastError = 0;
+  while (length)
+  {
+    uint8_t chunk = length < limit ? length : limit;
+    getSegment(cmd, offset, chunk, ptr);
+    if (_lastError)
+    {
+      memset(ptr, 0, length);
+      return;
+    }
+    offset += chunk;
+    ptr += chunk;
+    length -= chunk;
+  }
 }
 
-uint16_t TicBase::getCurrentLimit()
+void TicBase::decodeVariables(const uint8_t * buffer, TicVariables & vars)
 {
-  uint8_t code = getVar8(VarOffset::CurrentLimit);
-  if (product == TicProduct::T500)
+  uint8_t miscFlags1 = buffer[VarOffset::MiscFlags1];
+
+  vars.operationState = (TicOperationState)buffer[VarOffset::OperationState];
+  vars.energized = miscFlags1 >> (uint8_t)TicMiscFlags1::Energized & 1;
+  vars.positionUncertain =
+    miscFlags1 >> (uint8_t)TicMiscFlags1::PositionUncertain & 1;
+  vars.forwardLimitActive =
+    miscFlags1 >> (uint8_t)TicMiscFlags1::ForwardLimitActive & 1;
+  vars.reverseLimitActive =
+    miscFlags1 >> (uint8_t)TicMiscFlags1::ReverseLimitActive & 1;
+  vars.homingActive = miscFlags1 >> (uint8_t)TicMiscFlags1::HomingActive & 1;
+  vars.errorStatus = read16(buffer + VarOffset::ErrorStatus);
+  vars.errorsOccurred = read32(buffer + VarOffset::ErrorsOccurred);
+  vars.planningMode = (TicPlanningMode)buffer[VarOffset::PlanningMode];
+  vars.targetPosition = read32(buffer + VarOffset::TargetPosition);
+  vars.targetVelocity = read32(buffer + VarOffset::TargetVelocity);
+  vars.startingSpeed = read32(buffer + VarOffset::StartingSpeed);
+  vars.maxSpeed = read32(buffer + VarOffset::SpeedMax);
+  vars.maxDecel = read32(buffer + VarOffset::DecelMax);
+  vars.maxAccel = read32(buffer + VarOffset::AccelMax);
+  vars.currentPosition = read32(buffer + VarOffset::CurrentPosition);
+  vars.currentVelocity = read32(buffer + VarOffset::CurrentVelocity);
+  vars.actingTargetPosition = read32(buffer + VarOffset::ActingTargetPosition);
+  vars.timeSinceLastStep = read32(buffer + VarOffset::TimeSinceLastStep);
+  vars.deviceReset = (TicReset)buffer[VarOffset::DeviceReset];
+  vars.vinVoltage = read16(buffer + VarOffset::VinVoltage);
+  vars.upTime = read32(buffer + VarOffset::UpTime);
+  vars.encoderPosition = read32(buffer + VarOffset::EncoderPosition);
+  vars.rcPulseWidth = read16(buffer + VarOffset::RCPulseWidth);
+  for (uint8_t i = 0; i < 4; i++)
   {
-    if (code > 32) { code = 32; }
-    return Tic03aCurrentTable[code];
+    vars.analogReadings[i] =
+      read16(buffer + VarOffset::AnalogReadingSCL + 2 * i);
   }
-  else if (product == TicProduct::T249)
+  vars.digitalReadings = buffer[VarOffset::DigitalReadings];
+  vars.pinStates = buffer[VarOffset::PinStates];
+  vars.stepMode = (TicStepMode)buffer[VarOffset::StepMode];
+  vars.currentLimit = currentLimitFromCode(buffer[VarOffset::CurrentLimit]);
+  vars.decayMode = (TicDecayMode)buffer[VarOffset::DecayMode];
+  vars.inputState = (TicInputState)buffer[VarOffset::InputState];
+  vars.inputAfterAveraging = read16(buffer + VarOffset::InputAfterAveraging);
+  vars.inputAfterHysteresis = read16(buffer + VarOffset::InputAfterHysteresis);
+  vars.inputAfterScaling = read32(buffer + VarOffset::InputAfterScaling);
+  vars.lastMotorDriverError =
+    (TicMotorDriverError)buffer[VarOffset::LastMotorDriverError];
+  vars.agcMode = (TicAgcMode)buffer[VarOffset::AgcMode];
+  vars.agcBottomCurrentLimit =
+    (TicAgcBottomCurrentLimit)buffer[VarOffset::AgcBottomCurrentLimit];
+  vars.agcCurrentBoostSteps =
+    (TicAgcCurrentBoostSteps)buffer[VarOffset::AgcCurrentBoostSteps];
+  vars.agcFrequencyLimit =
+    (TicAgcFrequencyLimit)buffer[VarOffset::AgcFrequencyLimit];
+}
+
+/**** TicSettings ****/
+
+uint16_t TicSettings::getCurrentLimit() const
+{
+  return TicBase::currentLimitFromCode(product,
+    data[SettingOffset::CurrentLimit]);
+}
+
+/**** TicCommandShadow ****/
+
+// Returns the slot that remembers the value of the command, or SlotCount if
+// the command is not shadowed.
+uint8_t TicCommandShadow::slotFor(TicCommand cmd, uint32_t val)
+{
+  switch (cmd)
   {
-    return code * TicT249CurrentUnits;
+  case TicCommand::SetTargetPosition: return TargetPosition;
+  case TicCommand::SetTargetVelocity: return TargetVelocity;
+  case TicCommand::SetSpeedMax:       return SpeedMax;
+  case TicCommand::SetStartingSpeed:  return StartingSpeed;
+  case TicCommand::SetAccelMax:       return AccelMax;
+  case TicCommand::SetDecelMax:       return DecelMax;
+  case TicCommand::SetStepMode:       return StepMode;
+  case TicCommand::SetCurrentLimit:   return CurrentLimit;
+  case TicCommand::SetDecayMode:      return DecayMode;
+  case TicCommand::SetAgcOption:      return Agc + (val >> 4 & 3);
+  default:                            return SlotCount;
   }
-  else if (product == TicProduct::Tic36v4)
+}
+
+bool TicCommandShadow::isRedundant(TicCommand cmd, uint32_t val,
+  uint16_t lastCommandTime)
+{
+  uint8_t slot = slotFor(cmd, val);
+  if (slot == SlotCount || !(valid >> slot & 1) || values[slot] != val)
   {
-    return ((uint32_t)55000 * code + 384) / 768;
+    return false;
   }
-  else
+
+  // Send the command anyway if it is needed to reset the command timeout.
+  if (refreshInterval &&
+    (uint16_t)((uint16_t)millis() - lastCommandTime) >= refreshInterval)
   {
-    return code * TicCurrentUnits;
+    return false;
   }
+
+  skipped++;
+  return true;
 }
 
-/**** TicSerial ****/
+void TicCommandShadow::commandSent(TicCommand cmd, uint32_t val,
+  uint8_t error)
+{
+  if (error)
+  {
+    invalidate();
+    return;
+  }
+
+  uint8_t slot = slotFor(cmd, val);
+  if (slot == TargetPosition)
+  {
+    valid &= ~(1 << TargetVelocity);
+  }
+  else if (slot == TargetVelocity)
+  {
+    valid &= ~(1 << TargetPosition);
+  }
+  else if (slot == SlotCount && cmd != TicCommand::ResetCommandTimeout)
+  {
+    invalidateTargets();
+  }
+
+  if (slot != SlotCount)
+  {
+    values[slot] = val;
+    valid |= 1 << slot;
+    sent++;
+  }
+}
 
-void TicSerial::commandW32(TicCommand cmd, uint32_t val)
+void TicCommandShadow::noteUpTime(uint32_t upTime)
 {
-  sendCommandHeader(cmd);
+  if (upTime < lastUpTime) { invalidate(); }
+  lastUpTime = upTime;
+}
 
-  // byte with MSbs:
-  // bit 0 = MSb of first (least significant) data byte
-  // bit 1 = MSb of second data byte
-  // bit 2 = MSb of third data byte
-  // bit 3 = MSb of fourth (most significant) data byte
-  serialW7(((val >>  7) & 1) |
-           ((val >> 14) & 2) |
-           ((val >> 21) & 4) |
-           ((val >> 28) & 8));
+void TicCommandShadow::noteDeviceReset(uint8_t deviceReset)
+{
+  if (lastDeviceReset != 0xFF && deviceReset != lastDeviceReset)
+  {
+    invalidate();
+  }
+  lastDeviceReset = deviceReset;
+}
 
-  serialW7(val >> 0); // least significant byte with MSb cleared
-  serialW7(val >> 8);
-  serialW7(val >> 16);
-  serialW7(val >> 24); // most significant byte with MSb cleared
+/**** TicStats ****/
 
-  _lastError = 0;
+#ifdef TIC_INSTRUMENTATION
+
+static const uint8_t ticStatsCommands[] PROGMEM = {
+  (uint8_t)TicCommand::SetTargetPosition,
+  (uint8_t)TicCommand::SetTargetVelocity,
+  (uint8_t)TicCommand::HaltAndSetPosition,
+  (uint8_t)TicCommand::HaltAndHold,
+  (uint8_t)TicCommand::GoHome,
+  (uint8_t)TicCommand::ResetCommandTimeout,
+  (uint8_t)TicCommand::Deenergize,
+  (uint8_t)TicCommand::Energize,
+  (uint8_t)TicCommand::ExitSafeStart,
+  (uint8_t)TicCommand::EnterSafeStart,
+  (uint8_t)TicCommand::Reset,
+  (uint8_t)TicCommand::ClearDriverError,
+  (uint8_t)TicCommand::SetSpeedMax,
+  (uint8_t)TicCommand::SetStartingSpeed,
+  (uint8_t)TicCommand::SetAccelMax,
+  (uint8_t)TicCommand::SetDecelMax,
+  (uint8_t)TicCommand::SetStepMode,
+  (uint8_t)TicCommand::SetCurrentLimit,
+  (uint8_t)TicCommand::SetDecayMode,
+  (uint8_t)TicCommand::SetAgcOption,
+  (uint8_t)TicCommand::GetVariable,
+  (uint8_t)TicCommand::GetVariableAndClearErrorsOccurred,
+  (uint8_t)TicCommand::GetSetting,
+};
+
+static_assert(sizeof(ticStatsCommands) == 23,
+  "TicStats::commandCount must match the number of commands.");
+
+void TicStats::reset()
+{
+  memset(counts, 0, sizeof(counts));
+  memset(errors, 0, sizeof(errors));
+  memset(latency, 0, sizeof(latency));
+  bytesSent = 0;
+  bytesReceived = 0;
+}
+
+uint8_t TicStats::commandIndex(TicCommand cmd)
+{
+  for (uint8_t i = 0; i < commandCount; i++)
+  {
+    if (pgm_read_byte(&ticStatsCommands[i]) == (uint8_t)cmd) { return i; }
+  }
+  return 0xFF;
 }
 
-void TicSerial::commandW7(TicCommand cmd, uint8_t val)
+// Errors 1 to 5 come from the I2C library, and 50 and 51 from TicSerial.
+// The last slot holds every other error.
+uint8_t TicStats::errorIndex(uint8_t error)
 {
-  sendCommandHeader(cmd);
-  serialW7(val);
+  if (error >= 1 && error <= 5) { return error - 1; }
+  if (error == 50) { return 5; }
+  if (error == 51) { return 6; }
+  return 7;
+}
 
-  _lastError = 0;
+uint32_t TicStats::getCount(TicCommand cmd)
+{
+  uint8_t index = commandIndex(cmd);
+  return index < commandCount ? counts[index] : 0;
 }
 
-void TicSerial::getSegment(TicCommand cmd, uint8_t offset,
+uint32_t TicStats::getErrorCount(uint8_t error)
+{
+  if (error == 0) { return 0; }
+  return errors[errorIndex(error)];
+}
+
+uint32_t TicStats::getErrorTotal()
+{
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < errorSlots; i++) { total += errors[i]; }
+  return total;
+}
+
+void TicStats::record(TicCommand cmd, uint8_t error, uint32_t start,
+  uint8_t sent, uint8_t received)
+{
+  uint32_t elapsed = now() - start;
+
+  uint8_t index = commandIndex(cmd);
+  if (index < commandCount) { counts[index]++; }
+  if (error) { errors[errorIndex(error)]++; }
+  bytesSent += sent;
+  bytesReceived += received;
+
+  uint8_t bucket = 0;
+  while (bucket < TicStatsLatencyBuckets - 1 &&
+    elapsed >= getLatencyLimit(bucket))
+  {
+    bucket++;
+  }
+  latency[bucket]++;
+}
+
+#endif
+
+/**** TicReadPlanner ****/
+
+constexpr uint8_t TicReadPlanner::offsets[TicVariableCount];
+constexpr uint8_t TicReadPlanner::sizes[TicVariableCount];
+
+/**** TicSerial ****/
+
+// Lookup table for the CRC-7 used by the Pololu serial protocols (polynomial
+// 0x91, least-significant bit first).  Each entry is the CRC of one byte.
+static const uint8_t TicCrc7Table[256] PROGMEM =
+{
+  0x00, 0x41, 0x13, 0x52, 0x26, 0x67, 0x35, 0x74,
+  0x4C, 0x0D, 0x5F, 0x1E, 0x6A, 0x2B, 0x79, 0x38,
+  0x09, 0x48, 0x1A, 0x5B, 0x2F, 0x6E, 0x3C, 0x7D,
+  0x45, 0x04, 0x56, 0x17, 0x63, 0x22, 0x70, 0x31,
+  0x12, 0x53, 0x01, 0x40, 0x34, 0x75, 0x27, 0x66,
+  0x5E, 0x1F, 0x4D, 0x0C, 0x78, 0x39, 0x6B, 0x2A,
+  0x1B, 0x5A, 0x08, 0x49, 0x3D, 0x7C, 0x2E, 0x6F,
+  0x57, 0x16, 0x44, 0x05, 0x71, 0x30, 0x62, 0x23,
+  0x24, 0x65, 0x37, 0x76, 0x02, 0x43, 0x11, 0x50,
+  0x68, 0x29, 0x7B, 0x3A, 0x4E, 0x0F, 0x5D, 0x1C,
+  0x2D, 0x6C, 0x3E, 0x7F, 0x0B, 0x4A, 0x18, 0x59,
+  0x61, 0x20, 0x72, 0x33, 0x47, 0x06, 0x54, 0x15,
+  0x36, 0x77, 0x25, 0x64, 0x10, 0x51, 0x03, 0x42,
+  0x7A, 0x3B, 0x69, 0x28, 0x5C, 0x1D, 0x4F, 0x0E,
+  0x3F, 0x7E, 0x2C, 0x6D, 0x19, 0x58, 0x0A, 0x4B,
+  0x73, 0x32, 0x60, 0x21, 0x55, 0x14, 0x46, 0x07,
+  0x48, 0x09, 0x5B, 0x1A, 0x6E, 0x2F, 0x7D, 0x3C,
+  0x04, 0x45, 0x17, 0x56, 0x22, 0x63, 0x31, 0x70,
+  0x41, 0x00, 0x52, 0x13, 0x67, 0x26, 0x74, 0x35,
+  0x0D, 0x4C, 0x1E, 0x5F, 0x2B, 0x6A, 0x38, 0x79,
+  0x5A, 0x1B, 0x49, 0x08, 0x7C, 0x3D, 0x6F, 0x2E,
+  0x16, 0x57, 0x05, 0x44, 0x30, 0x71, 0x23, 0x62,
+  0x53, 0x12, 0x40, 0x01, 0x75, 0x34, 0x66, 0x27,
+  0x1F, 0x5E, 0x0C, 0x4D, 0x39, 0x78, 0x2A, 0x6B,
+  0x6C, 0x2D, 0x7F, 0x3E, 0x4A, 0x0B, 0x59, 0x18,
+  0x20, 0x61, 0x33, 0x72, 0x06, 0x47, 0x15, 0x54,
+  0x65, 0x24, 0x76, 0x37, 0x43, 0x02, 0x50, 0x11,
+  0x29, 0x68, 0x3A, 0x7B, 0x0F, 0x4E, 0x1C, 0x5D,
+  0x7E, 0x3F, 0x6D, 0x2C, 0x58, 0x19, 0x4B, 0x0A,
+  0x32, 0x73, 0x21, 0x60, 0x14, 0x55, 0x07, 0x46,
+  0x77, 0x36, 0x64, 0x25, 0x51, 0x10, 0x42, 0x03,
+  0x3B, 0x7A, 0x28, 0x69, 0x1D, 0x5C, 0x0E, 0x4F,
+};
+
+uint8_t TicSerialTransport::getSegment(TicCommand cmd, uint8_t offset,
   uint8_t length, void * buffer)
 {
   length &= 0x3F;
-  sendCommandHeader(cmd);
-  serialW7(offset & 0x7F);
-  serialW7(length | (offset >> 1 & 0x40));
+  sendSegmentRequest(cmd, offset, length);
 
+  uint8_t error = 0;
   uint8_t byteCount = _stream->readBytes((uint8_t *)buffer, length);
   if (byteCount != length)
   {
-    _lastError = 50;
+    error = 50;
+  }
+  else if (_crcForResponses)
+  {
+    uint8_t crc;
+    if (_stream->readBytes(&crc, 1) != 1)
+    {
+      error = 50;
+    }
+    else if (crc != crc7((const uint8_t *)buffer, length))
+    {
+      error = 51;
+    }
+  }
 
+  if (error)
+  {
     // Set the buffer bytes to 0 so the program will not use an uninitialized
     // variable.
     memset(buffer, 0, length);
-    return;
   }
+  return error;
+}
 
-  _lastError = 0;
+void TicSerial::getSegment(TicCommand cmd, uint8_t offset,
+  uint8_t length, void * buffer)
+{
+  // The response to a pending non-blocking request comes first.
+  finishRequest();
+
+  uint8_t attempt = 0;
+  while (true)
+  {
+    uint32_t start = statsStart();
+    _lastError = _transport.getSegment(cmd, offset, length, buffer);
+    statsRecord(cmd, start, _transport.bytesSent(cmd),
+      _transport.bytesReceived(length));
+    if (_lastError == 0 || attempt >= _retryLimit) { return; }
+    attempt++;
+
+    // Discard anything left over from the failed attempt before retrying.
+    Stream * stream = _transport._stream;
+    while (stream->available() > 0) { stream->read(); }
+  }
 }
 
-void TicSerial::sendCommandHeader(TicCommand cmd)
+void TicSerial::beginGetSegment(TicCommand cmd, uint8_t offset,
+  uint8_t length, void * buffer)
 {
-  if (_deviceNumber == 255)
+  // Wait for a free slot in the queue.
+  while (_requestCount >= _requestQueueSize) { poll(); }
+
+  length &= 0x3F;
+  _transport.sendSegmentRequest(cmd, offset, length);
+
+  if (_requestCount == 0)
   {
-    // Compact protocol
-    _stream->write((uint8_t)cmd);
+    _requestReceived = 0;
+    _requestStartTime = millis();
+    _requestError = 0;
   }
-  else
+
+  uint8_t index = (_requestHead + _requestCount) % _requestQueueSize;
+  _requestQueue[index].buffer = (uint8_t *)buffer;
+  _requestQueue[index].length = length;
+  _requestCount++;
+}
+
+bool TicSerial::poll()
+{
+  // Leave getLastError() alone unless a request finishes in this call.
+  if (_requestCount == 0) { return true; }
+
+  while (_requestCount)
   {
-    // Pololu protocol
-    _stream->write((uint8_t)0xAA);
-    serialW7(_deviceNumber);
-    serialW7((uint8_t)cmd);
+    TicSerialRequest & request = _requestQueue[_requestHead];
+
+    // With CRC enabled, each response ends with a CRC byte.
+    uint8_t responseLength = request.length + _transport._crcForResponses;
+
+    while (_requestReceived < responseLength &&
+      _transport._stream->available() > 0)
+    {
+      uint8_t byte = _transport._stream->read();
+      if (_requestReceived < request.length)
+      {
+        request.buffer[_requestReceived] = byte;
+      }
+      else if (byte != TicSerialTransport::crc7(request.buffer, request.length))
+      {
+        _requestError = 51;
+        memset(request.buffer, 0, request.length);
+      }
+      _requestReceived++;
+    }
+
+    if (_requestReceived < responseLength)
+    {
+      if ((uint16_t)((uint16_t)millis() - _requestStartTime) <= _requestTimeout)
+      {
+        return false;
+      }
+
+      // The request timed out.  Any bytes that arrive later would be mistaken
+      // for the responses to the other pending requests, so fail them all.
+      _requestError = 50;
+      while (_requestCount)
+      {
+        TicSerialRequest & failed = _requestQueue[_requestHead];
+
+        // Set the buffer bytes to 0 so the program will not use an
+        // uninitialized variable.
+        memset(failed.buffer, 0, failed.length);
+        _requestHead = (_requestHead + 1) % _requestQueueSize;
+        _requestCount--;
+      }
+      break;
+    }
+
+    // This request is done; start timing the next one.
+    _requestHead = (_requestHead + 1) % _requestQueueSize;
+    _requestCount--;
+    _requestReceived = 0;
+    _requestStartTime = millis();
   }
-  _lastError = 0;
+
+  _lastError = _requestError;
+  return true;
 }
 
-/**** TicI2C ****/
+void TicSerialTransport::sendSegmentRequest(TicCommand cmd, uint8_t offset,
+  uint8_t length)
+{
+  uint8_t frame[maxFrameLength];
+  uint8_t frameLength = writeHeader(frame, cmd);
+  frame[frameLength++] = offset & 0x7F;
+  frame[frameLength++] = (length & 0x3F) | (offset >> 1 & 0x40);
+  sendFrame(frame, frameLength);
+}
 
-void TicI2C::commandQuick(TicCommand cmd)
+uint8_t TicSerialTransport::crc7(const uint8_t * message, uint8_t length)
 {
-  _bus->beginTransmission(_address);
-  _bus->write((uint8_t)cmd);
-  _lastError = _bus->endTransmission();
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < length; i++)
+  {
+    crc = pgm_read_byte(&TicCrc7Table[crc ^ message[i]]);
+  }
+  return crc;
 }
 
-void TicI2C::commandW32(TicCommand cmd, uint32_t val)
+/**** TicSerialBatch ****/
+
+size_t TicSerialBatch::write(uint8_t byte)
 {
-  _bus->beginTransmission(_address);
-  _bus->write((uint8_t)cmd);
-  _bus->write((uint8_t)(val >> 0)); // lowest byte
-  _bus->write((uint8_t)(val >> 8));
-  _bus->write((uint8_t)(val >> 16));
-  _bus->write((uint8_t)(val >> 24)); // highest byte
-  _lastError = _bus->endTransmission();
+  return write(&byte, 1);
 }
 
-void TicI2C::commandW7(TicCommand cmd, uint8_t val)
+size_t TicSerialBatch::write(const uint8_t * data, size_t length)
 {
-  _bus->beginTransmission(_address);
-  _bus->write((uint8_t)cmd);
-  _bus->write((uint8_t)(val & 0x7F));
-  _lastError = _bus->endTransmission();
+  if (_length + length > _size)
+  {
+    flush();
+    if (length > _size)
+    {
+      // Too big to buffer, so send it right away.
+      return _stream->write(data, length);
+    }
+  }
+  memcpy(_buffer + _length, data, length);
+  _length += length;
+  return length;
+}
+
+void TicSerialBatch::flush()
+{
+  if (_length)
+  {
+    _stream->write(_buffer, _length);
+    _length = 0;
+  }
+}
+
+/**** TicTraceBuffer ****/
+
+void TicTraceBuffer::clear()
+{
+  _head = 0;
+  _used = 0;
+  _open = none;
+  _dropped = 0;
+  _lastTime = _clock();
+}
+
+// Drops the oldest records until there is room for the specified number of
+// bytes.  Returns false if that many bytes would never fit.
+bool TicTraceBuffer::makeRoom(uint16_t length)
+{
+  if (length > _size) { return false; }
+  while (_size - _used < length)
+  {
+    if (_head == _open) { _open = none; }
+    uint8_t header = at(_head);
+    uint16_t recordLength = 1;
+    while (at((uint32_t)_head + recordLength) & 0x80) { recordLength++; }
+    recordLength += 1 + (header & TicTraceMaxData);
+    _head = ((uint32_t)_head + recordLength) % _size;
+    _used -= recordLength;
+    _dropped++;
+  }
+  return true;
+}
+
+void TicTraceBuffer::put(uint8_t byte)
+{
+  _buffer[((uint32_t)_head + _used) % _size] = byte;
+  _used++;
+}
+
+// Writes a record's header byte and time.  Returns false if the record was
+// dropped because it does not fit in the buffer.
+bool TicTraceBuffer::startRecord(uint8_t flags, uint8_t length)
+{
+  unsigned long now = _clock();
+  uint32_t time = now - _lastTime;
+
+  uint8_t timeLength = 1;
+  for (uint32_t t = time >> 7; t; t >>= 7) { timeLength++; }
+
+  if (!makeRoom(1 + timeLength + length))
+  {
+    _dropped++;
+    return false;
+  }
+
+  _lastTime = now;
+  put(flags | length);
+  while (time >= 0x80)
+  {
+    put(time | 0x80);
+    time >>= 7;
+  }
+  put(time);
+  return true;
+}
+
+void TicTraceBuffer::record(uint8_t flags, const uint8_t * data,
+  uint8_t length)
+{
+  flags &= TicTraceReceived | TicTraceI2C;
+  _open = none;
+  while (length)
+  {
+    uint8_t chunk = length < TicTraceMaxData ? length : TicTraceMaxData;
+    if (startRecord(flags, chunk))
+    {
+      for (uint8_t i = 0; i < chunk; i++) { put(data[i]); }
+    }
+    data += chunk;
+    length -= chunk;
+  }
+}
+
+void TicTraceBuffer::append(uint8_t flags, uint8_t byte)
+{
+  flags &= TicTraceReceived | TicTraceI2C;
+
+  if (_open != none)
+  {
+    uint8_t header = _buffer[_open];
+    if ((header & ~TicTraceMaxData) == flags &&
+      (header & TicTraceMaxData) < TicTraceMaxData &&
+      makeRoom(1) && _open != none)
+    {
+      _buffer[_open] = header + 1;
+      put(byte);
+      return;
+    }
+  }
+
+  // Dropping old records does not move the end of the buffer, so this is
+  // where the new record's header goes.
+  uint16_t start = ((uint32_t)_head + _used) % _size;
+  _open = none;
+  if (startRecord(flags, 1))
+  {
+    put(byte);
+    _open = start;
+  }
+}
+
+void TicTraceBuffer::dump(Print & out)
+{
+  static const uint8_t magic[] = { 'T', 'i', 'c', 'T', 1 };
+  out.write(magic, sizeof(magic));
+
+  uint16_t firstLength = _size - _head;
+  if (firstLength > _used) { firstLength = _used; }
+  out.write(_buffer + _head, firstLength);
+  out.write(_buffer, _used - firstLength);
+}
+
+size_t TicTraceStream::write(const uint8_t * data, size_t length)
+{
+  for (size_t i = 0; i < length; i += TicTraceMaxData)
+  {
+    size_t chunk = length - i;
+    if (chunk > TicTraceMaxData) { chunk = TicTraceMaxData; }
+    _trace->record(0, data + i, chunk);
+  }
+  return _stream->write(data, length);
 }
 
-void TicI2C::getSegment(TicCommand cmd, uint8_t offset,
+/**** TicI2C ****/
+
+void TicI2CTransport::trace(TicCommand cmd, uint32_t val, uint8_t dataLength)
+{
+  uint8_t data[6] = { _address, (uint8_t)cmd,
+    (uint8_t)(val >> 0), (uint8_t)(val >> 8),
+    (uint8_t)(val >> 16), (uint8_t)(val >> 24) };
+  _trace->record(TicTraceI2C, data, 2 + dataLength);
+}
+
+uint8_t TicI2CTransport::getSegment(TicCommand cmd, uint8_t offset,
   uint8_t length, void * buffer)
 {
   _bus->beginTransmission(_address);
   _bus->write((uint8_t)cmd);
   _bus->write(offset);
-  _lastError = _bus->endTransmission(false); // no stop (repeated start)
-  if (_lastError)
+  if (_trace) { trace(cmd, offset, 1); }
+  uint8_t error = _bus->endTransmission(false); // no stop (repeated start)
+  if (error)
   {
     // Set the buffer bytes to 0 so the program will not use an uninitialized
     // variable.
     memset(buffer, 0, length);
-    return;
+    return error;
   }
 
   uint8_t byteCount = _bus->requestFrom(_address, (uint8_t)length);
   if (byteCount != length)
   {
-    _lastError = 50;
     memset(buffer, 0, length);
-    return;
+    return 50;
   }
 
-  _lastError = 0;
   uint8_t * ptr = (uint8_t *)buffer;
   for (uint8_t i = 0; i < length; i++)
   {
     *ptr = _bus->read();
     ptr++;
   }
+
+  if (_trace)
+  {
+    const uint8_t flags = TicTraceI2C | TicTraceReceived;
+    _trace->append(flags, _address);
+    for (uint8_t i = 0; i < length; i++)
+    {
+      _trace->append(flags, ((uint8_t *)buffer)[i]);
+    }
+  }
+  return 0;
+}
+
+uint8_t TicI2CTransport::maxSegmentLength()
+{
+  // The I2C library can only receive as many bytes as fit in its buffer.
+#if defined(BUFFER_LENGTH)
+  const uint16_t bufferLength = BUFFER_LENGTH;
+#elif defined(I2C_BUFFER_LENGTH)
+  const uint16_t bufferLength = I2C_BUFFER_LENGTH;
+#else
+  const uint16_t bufferLength = TicMaxSegmentLength;
+#endif
+
+  if (bufferLength < TicMaxSegmentLength) { return bufferLength; }
+  return TicMaxSegmentLength;
+}
+
+/**** TicKeepalive ****/
+
+TicKeepalive::TicKeepalive(uint16_t interval)
+  : _interval(interval)
+{
+  // Due times are compared as signed 16-bit differences.
+  if (_interval > TicMaxKeepaliveInterval)
+  {
+    _interval = TicMaxKeepaliveInterval;
+  }
+  _slotWidth = (_interval + slotCount - 1) / slotCount;
+  if (_slotWidth == 0) { _slotWidth = 1; }
+  _slotEnd = (uint16_t)millis() + _slotWidth;
+}
+
+void TicKeepalive::add(TicKeepaliveEntry & entry)
+{
+  entry._due = dueTime(entry._tic, millis());
+  insert(&entry);
+}
+
+void TicKeepalive::remove(TicKeepaliveEntry & entry)
+{
+  for (uint8_t i = 0; i < slotCount; i++)
+  {
+    for (TicKeepaliveEntry ** p = &_slots[i]; *p; p = &(*p)->_next)
+    {
+      if (*p == &entry)
+      {
+        *p = entry._next;
+        entry._next = nullptr;
+        return;
+      }
+    }
+  }
+}
+
+// Returns the time at which the Tic needs a "Reset command timeout" command.
+// The recorded time is only 16 bits, so a Tic that was never commanded, or
+// was last commanded more than about 32 seconds ago, can look like it was
+// commanded in the future; treat anything that is not recent as due now.
+uint16_t TicKeepalive::dueTime(TicBase * tic, uint16_t now)
+{
+  uint16_t last = tic->getLastCommandTime();
+  if ((uint16_t)(now - last) >= _interval) { return now; }
+  return last + _interval;
+}
+
+// Puts the entry in the slot that ends soonest after its due time.  Entries
+// that are already due go in the current slot.
+void TicKeepalive::insert(TicKeepaliveEntry * entry)
+{
+  uint16_t slotStart = _slotEnd - _slotWidth;
+  int16_t delay = entry->_due - slotStart;
+  uint8_t index = 0;
+  if (delay > 0)
+  {
+    index = delay / _slotWidth;
+    if (index >= slotCount) { index = slotCount - 1; }
+  }
+  index = (_slot + index) % slotCount;
+
+  entry->_next = _slots[index];
+  _slots[index] = entry;
+}
+
+void TicKeepalive::update()
+{
+  uint16_t now = millis();
+  while ((int16_t)(now - _slotEnd) >= 0)
+  {
+    // Take the list for the slot that just ended and move to the next slot
+    // before reinserting anything, so entries are never put back into the
+    // list being processed.
+    TicKeepaliveEntry * entry = _slots[_slot];
+    _slots[_slot] = nullptr;
+    _slot = (_slot + 1) % slotCount;
+    _slotEnd += _slotWidth;
+
+    while (entry)
+    {
+      TicKeepaliveEntry * next = entry->_next;
+
+      entry->_due = dueTime(entry->_tic, now);
+      if (entry->_due == now)
+      {
+        entry->_tic->resetCommandTimeout();
+        entry->_due = now + _interval;
+      }
+      insert(entry);
+
+      entry = next;
+    }
+  }
+}
+
+/**** TicCommandQueue ****/
+
+// Returns the kind of value the command sets, or SlotCount if it must be sent
+// in order.  The two kinds of targets are the same kind.
+uint8_t TicCommandQueue::kindOf(TicCommand cmd, uint32_t val)
+{
+  uint8_t kind = TicCommandShadow::slotFor(cmd, val);
+  if (kind == TicCommandShadow::TargetVelocity)
+  {
+    kind = TicCommandShadow::TargetPosition;
+  }
+  return kind;
+}
+
+bool TicCommandQueue::push(TicCommand cmd, uint32_t val)
+{
+  uint8_t kind = kindOf(cmd, val);
+  if (kind != TicCommandShadow::SlotCount)
+  {
+    // Look for a pending command of the same kind, newest first, stopping at
+    // the first command that must stay in order.
+    for (uint8_t i = _count; i > 0; i--)
+    {
+      TicQueuedCommand & pending = at(i - 1);
+      uint8_t pendingKind = kindOf(pending.cmd, pending.val);
+      if (pendingKind == TicCommandShadow::SlotCount) { break; }
+      if (pendingKind == kind)
+      {
+        pending.cmd = cmd;
+        pending.val = val;
+        _coalesced++;
+        return true;
+      }
+    }
+  }
+
+  if (_count >= _size) { return false; }
+  TicQueuedCommand & entry = at(_count);
+  entry.cmd = cmd;
+  entry.val = val;
+  _count++;
+  return true;
+}
+
+bool TicCommandQueue::update()
+{
+  if (_count == 0) { return false; }
+  uint32_t now = micros();
+  if ((uint32_t)(now - _lastSendTime) < _interval) { return false; }
+  _lastSendTime = now;
+  sendNext();
+  return true;
+}
+
+void TicCommandQueue::flush()
+{
+  while (_count) { sendNext(); }
+  _lastSendTime = micros();
+}
+
+void TicCommandQueue::sendNext()
+{
+  TicQueuedCommand entry = at(0);
+  _head = (_head + 1) % _size;
+  _count--;
+  _tic->sendCommand(entry.cmd, entry.val);
+}
+
+/**** TicScheduler ****/
+
+TicScheduler::TicScheduler(TicWorkItem * items, uint8_t size)
+  : _items(items), _size(size)
+{
+  for (uint8_t i = 0; i < _size; i++)
+  {
+    _items[i].tic = nullptr;
+  }
+}
+
+TicWorkItem * TicScheduler::allocate(TicPriority priority, TicBase & tic,
+  TicCommand cmd, uint16_t timeout)
+{
+  // Deadlines are compared as signed 16-bit differences.
+  if (timeout > TicMaxWorkTimeout) { timeout = TicMaxWorkTimeout; }
+
+  for (uint8_t i = 0; i < _size; i++)
+  {
+    TicWorkItem & item = _items[i];
+    if (item.tic) { continue; }
+    item.tic = &tic;
+    item.buffer = nullptr;
+    item.status = nullptr;
+    item.val = 0;
+    item.deadline = timeout ? (uint16_t)millis() + timeout : 0;
+    item.sequence = _sequence++;
+    item.cmd = cmd;
+    item.priority = priority;
+    item.offset = item.length = 0;
+    item.isRead = false;
+
+    // A deadline of 0 means there is none, so avoid it.
+    if (timeout && item.deadline == 0) { item.deadline = 1; }
+    return &item;
+  }
+  return nullptr;
+}
+
+bool TicScheduler::command(TicPriority priority, TicBase & tic,
+  TicCommand cmd, uint32_t val, uint16_t timeout)
+{
+  if (priority == TicPriority::Safety)
+  {
+    for (uint8_t i = 0; i < _size; i++)
+    {
+      TicWorkItem & item = _items[i];
+      if (item.tic == &tic && item.priority == TicPriority::Motion)
+      {
+        item.tic = nullptr;
+      }
+    }
+  }
+
+  TicWorkItem * item = allocate(priority, tic, cmd, timeout);
+  if (!item && priority == TicPriority::Safety)
+  {
+    evict();
+    item = allocate(priority, tic, cmd, timeout);
+  }
+  if (!item) { return false; }
+  item->val = val;
+  return true;
+}
+
+bool TicScheduler::read(TicPriority priority, TicBase & tic, TicCommand cmd,
+  uint8_t offset, uint8_t length, void * buffer, uint16_t timeout,
+  uint8_t * status)
+{
+  if (!buffer) { return false; }
+  TicWorkItem * item = allocate(priority, tic, cmd, timeout);
+  if (!item) { return false; }
+  item->isRead = true;
+  item->offset = offset;
+  item->length = length;
+  item->buffer = buffer;
+  item->status = status;
+  if (status) { *status = TicWorkPending; }
+  return true;
+}
+
+void TicScheduler::setBudget(TicPriority priority, uint16_t bytes,
+  uint16_t period)
+{
+  uint8_t p = (uint8_t)priority;
+  _budget[p] = bytes;
+  _period[p] = period;
+  _used[p] = 0;
+  _periodStart[p] = millis();
+}
+
+uint8_t TicScheduler::getCount()
+{
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < _size; i++)
+  {
+    if (_items[i].tic) { count++; }
+  }
+  return count;
+}
+
+// Returns the approximate number of bytes the work puts on the bus, using the
+// compact serial protocol.
+uint8_t TicScheduler::cost(const TicWorkItem & item)
+{
+  if (item.isRead) { return 3 + item.length; }
+  switch ((uint8_t)item.cmd & 0xF0)
+  {
+  case 0xE0: return 6;
+  case 0x90: return 2;
+  default: return 1;
+  }
+}
+
+// Returns true if `a` should be done before `b`, assuming they have the same
+// priority.
+bool TicScheduler::earlier(const TicWorkItem & a, const TicWorkItem & b)
+{
+  if (a.deadline && b.deadline && a.deadline != b.deadline)
+  {
+    return (int16_t)(a.deadline - b.deadline) < 0;
+  }
+  if (a.deadline && !b.deadline) { return true; }
+  if (!a.deadline && b.deadline) { return false; }
+  return (int16_t)(a.sequence - b.sequence) < 0;
+}
+
+void TicScheduler::finish(TicWorkItem & item, uint8_t status)
+{
+  if (item.status) { *item.status = status; }
+  item.tic = nullptr;
+}
+
+// Drops the piece of work that would be done last, to make room for a
+// Safety command.  Safety work is never dropped.
+void TicScheduler::evict()
+{
+  TicWorkItem * last = nullptr;
+  for (uint8_t i = 0; i < _size; i++)
+  {
+    TicWorkItem & item = _items[i];
+    if (!item.tic || item.priority == TicPriority::Safety) { continue; }
+
+    if (!last || item.priority > last->priority ||
+      (item.priority == last->priority && earlier(*last, item)))
+    {
+      last = &item;
+    }
+  }
+  if (last)
+  {
+    _evicted++;
+    finish(*last, TicWorkExpired);
+  }
+}
+
+bool TicScheduler::update()
+{
+  uint16_t now = millis();
+
+  for (uint8_t p = 0; p < TicPriorityCount; p++)
+  {
+    if (_budget[p] && (uint16_t)(now - _periodStart[p]) >= _period[p])
+    {
+      _used[p] = 0;
+      _periodStart[p] = now;
+    }
+  }
+
+  TicWorkItem * best = nullptr;
+  for (uint8_t i = 0; i < _size; i++)
+  {
+    TicWorkItem & item = _items[i];
+    if (!item.tic) { continue; }
+
+    if (item.deadline && (int16_t)(now - item.deadline) >= 0)
+    {
+      _expired++;
+      finish(item, TicWorkExpired);
+      continue;
+    }
+
+    uint8_t p = (uint8_t)item.priority;
+    if (item.priority != TicPriority::Safety && _budget[p] &&
+      _used[p] >= _budget[p])
+    {
+      continue;
+    }
+
+    if (!best || item.priority < best->priority ||
+      (item.priority == best->priority && earlier(item, *best)))
+    {
+      best = &item;
+    }
+  }
+
+  if (!best) { return false; }
+
+  _used[(uint8_t)best->priority] += cost(*best);
+  if (best->isRead)
+  {
+    best->tic->readBlock(best->cmd, best->offset, best->length, best->buffer);
+  }
+  else
+  {
+    best->tic->sendCommand(best->cmd, best->val);
+  }
+  finish(*best, best->tic->getLastError());
+  return true;
 }
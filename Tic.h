@@ -33,6 +33,116 @@ const uint8_t TicCurrentUnits = 32;
 /// Tic T249 native current unit, which is 40 mA.
 const uint8_t TicT249CurrentUnits = 40;
 
+/// This class template converts between milliamps and the current limit codes
+/// used by the specified type of Tic.  All of its functions are constexpr, so
+/// a constant current limit can be converted by the compiler:
+///
+/// ```
+/// constexpr uint8_t code = TicCurrentLimit<TicProduct::T500>::toCode(1000);
+/// tic.setCurrentLimitCode(code);
+/// ```
+///
+/// The primary template handles the Tic T825 and Tic T834 (and
+/// TicProduct::Unknown), and there are specializations for the other
+/// products.
+template <TicProduct product>
+struct TicCurrentLimit
+{
+  /// Returns the code for the highest current limit that is at most
+  /// `milliamps`.  Codes are limited to 127, the largest that fits in the
+  /// "Set current limit" command.
+  static constexpr uint8_t toCode(uint16_t milliamps)
+  {
+    return milliamps >= 128 * TicCurrentUnits ? 127 :
+      milliamps / TicCurrentUnits;
+  }
+
+  /// Returns the current limit in milliamps for a code.
+  static constexpr uint16_t fromCode(uint8_t code)
+  {
+    return code * TicCurrentUnits;
+  }
+};
+
+/// Current limit conversions for the Tic T249.  See TicCurrentLimit.
+template <>
+struct TicCurrentLimit<TicProduct::T249>
+{
+  static constexpr uint8_t toCode(uint16_t milliamps)
+  {
+    return milliamps >= 128 * TicT249CurrentUnits ? 127 :
+      milliamps / TicT249CurrentUnits;
+  }
+
+  static constexpr uint16_t fromCode(uint8_t code)
+  {
+    return code * TicT249CurrentUnits;
+  }
+};
+
+/// Current limit conversions for the Tic T500, which uses a table.  See
+/// TicCurrentLimit.
+template <>
+struct TicCurrentLimit<TicProduct::T500>
+{
+  static constexpr uint8_t toCode(uint16_t milliamps)
+  {
+    return search(milliamps, 0, maxCode);
+  }
+
+  static constexpr uint16_t fromCode(uint8_t code)
+  {
+    return table[code > maxCode ? maxCode : code];
+  }
+
+  static const uint8_t maxCode = 32;
+
+  /// The current limit in milliamps for each code.
+  static constexpr uint16_t table[maxCode + 1] =
+  {
+    0, 1, 174, 343, 495, 634, 762, 880, 990, 1092, 1189, 1281, 1368, 1452,
+    1532, 1611, 1687, 1762, 1835, 1909, 1982, 2056, 2131, 2207, 2285, 2366,
+    2451, 2540, 2634, 2734, 2843, 2962, 3093,
+  };
+
+private:
+  // Binary search for the highest code between `low` and `high` whose current
+  // is at most `milliamps`.  The current for `low` must be at most
+  // `milliamps`.
+  static constexpr uint8_t search(uint16_t milliamps, uint8_t low,
+    uint8_t high)
+  {
+    return low == high ? low :
+      table[(low + high + 1) / 2] <= milliamps ?
+        search(milliamps, (low + high + 1) / 2, high) :
+        search(milliamps, low, (low + high + 1) / 2 - 1);
+  }
+};
+
+/// Current limit conversions for the Tic 36v4.  See TicCurrentLimit.
+template <>
+struct TicCurrentLimit<TicProduct::Tic36v4>
+{
+  static constexpr uint8_t toCode(uint16_t milliamps)
+  {
+    return milliamps < 72 ? 0 :
+      milliamps >= 9095 ? 127 :
+      roundUp(milliamps, ((uint32_t)milliamps * 768 - 55000 / 2) / 55000);
+  }
+
+  static constexpr uint16_t fromCode(uint8_t code)
+  {
+    return ((uint32_t)55000 * code + 384) / 768;
+  }
+
+private:
+  // Corrects an estimate of the code that might be one too low.
+  static constexpr uint8_t roundUp(uint16_t milliamps, uint8_t code)
+  {
+    return code < 127 && fromCode(code + 1) <= milliamps ? code + 1 : code;
+  }
+};
+
 /// This is used to represent a null or missing value for some of the Tic's
 /// 16-bit input variables.
 const uint16_t TicInputNull = 0xFFFF;
@@ -304,6 +414,654 @@ enum class TicHpDriverError
   Verify = 7,
 };
 
+/// The number of bytes in the block of variables that
+/// TicBase::getVariables() reads from the Tic (offsets 0x00 through 0x59).
+const uint8_t TicVariablesSize = 0x5A;
+
+/// This struct holds a snapshot of the Tic's variables.  It is filled in by
+/// TicBase::getVariables(), which reads all of the variables using a small
+/// number of transfers instead of one transfer per variable.
+///
+/// Each member has the same meaning and units as the return value of the
+/// TicBase getter with the corresponding name, so see the documentation of
+/// those getters for details.  For example, `currentPosition` corresponds to
+/// TicBase::getCurrentPosition().
+///
+/// The "Last HP driver errors" variable is not stored in the same block as the
+/// other variables, so it is not included here.  Use
+/// TicBase::getLastHpDriverErrors() to read it.
+struct TicVariables
+{
+  TicOperationState operationState;
+  bool energized;
+  bool positionUncertain;
+  bool forwardLimitActive;
+  bool reverseLimitActive;
+  bool homingActive;
+  uint16_t errorStatus;
+
+  /// The errors that have occurred since the last time they were cleared.
+  /// Unlike TicBase::getErrorsOccurred(), TicBase::getVariables() does not
+  /// clear these bits.
+  uint32_t errorsOccurred;
+
+  TicPlanningMode planningMode;
+  int32_t targetPosition;
+  int32_t targetVelocity;
+  uint32_t startingSpeed;
+  uint32_t maxSpeed;
+  uint32_t maxDecel;
+  uint32_t maxAccel;
+  int32_t currentPosition;
+  int32_t currentVelocity;
+  int32_t actingTargetPosition;
+  uint32_t timeSinceLastStep;
+  TicReset deviceReset;
+  uint16_t vinVoltage;
+  uint32_t upTime;
+  int32_t encoderPosition;
+  uint16_t rcPulseWidth;
+
+  /// Analog readings for the SCL, SDA, TX, and RX pins, indexed by ::TicPin.
+  /// See TicBase::getAnalogReading().
+  uint16_t analogReadings[4];
+
+  /// Digital readings for each pin, one bit per ::TicPin.  See
+  /// getDigitalReading().
+  uint8_t digitalReadings;
+
+  /// Pin states, two bits per ::TicPin.  See getPinState().
+  uint8_t pinStates;
+
+  TicStepMode stepMode;
+
+  /// The current limit in milliamps, as computed by TicBase::getCurrentLimit().
+  uint16_t currentLimit;
+
+  TicDecayMode decayMode;
+  TicInputState inputState;
+  uint16_t inputAfterAveraging;
+  uint16_t inputAfterHysteresis;
+  int32_t inputAfterScaling;
+  TicMotorDriverError lastMotorDriverError;
+  TicAgcMode agcMode;
+  TicAgcBottomCurrentLimit agcBottomCurrentLimit;
+  TicAgcCurrentBoostSteps agcCurrentBoostSteps;
+  TicAgcFrequencyLimit agcFrequencyLimit;
+
+  /// Returns the digital reading of the specified pin from `digitalReadings`.
+  bool getDigitalReading(TicPin pin) const
+  {
+    return (digitalReadings >> (uint8_t)pin) & 1;
+  }
+
+  /// Returns the state of the specified pin from `pinStates`.
+  TicPinState getPinState(TicPin pin) const
+  {
+    return (TicPinState)(pinStates >> (2 * (uint8_t)pin) & 0b11);
+  }
+};
+
+/// This enum defines the Tic's control modes.
+///
+/// See TicSettings::getControlMode().
+enum class TicControlMode
+{
+  Serial          = 0,
+  StepDir         = 1,
+  RCPosition      = 2,
+  RCSpeed         = 3,
+  AnalogPosition  = 4,
+  AnalogSpeed     = 5,
+  EncoderPosition = 6,
+  EncoderSpeed    = 7,
+};
+
+/// The number of bytes of the Tic's settings that are stored in a
+/// TicSettings object (offsets 0x00 through 0x52).  This covers every setting
+/// that TicSettings decodes.
+const uint8_t TicSettingsSize = 0x53;
+
+/// This class holds a copy of the Tic's settings in RAM.  It is filled in by
+/// TicBase::reloadSettings(), which reads all of the settings at once, and
+/// after that its accessors do not communicate with the Tic.
+///
+/// Example usage:
+/// ```
+/// TicSettings settings;
+/// tic.reloadSettings(settings);
+/// if (settings.getControlMode() != TicControlMode::Serial)
+/// {
+///   // The Tic is not configured to accept serial commands.
+/// }
+/// ```
+///
+/// These are the settings stored in the Tic's EEPROM, which are used when the
+/// Tic starts up.  The values actually being used right now could be
+/// different: see TicBase::getMaxSpeed() and the other getters.
+///
+/// For information about the settings, see the "Settings reference" section of
+/// the Tic user's guide.
+class TicSettings
+{
+public:
+  /// Returns the control mode.
+  TicControlMode getControlMode() const
+  {
+    return (TicControlMode)data[SettingOffset::ControlMode];
+  }
+
+  /// Returns true if safe start is disabled.
+  bool getDisableSafeStart() const
+  {
+    return data[SettingOffset::DisableSafeStart] & 1;
+  }
+
+  /// Returns the serial device number.
+  uint8_t getSerialDeviceNumber() const
+  {
+    return data[SettingOffset::SerialDeviceNumber];
+  }
+
+  /// Returns the command timeout in milliseconds, or 0 if it is disabled.
+  uint16_t getCommandTimeout() const
+  {
+    return read16(SettingOffset::CommandTimeout);
+  }
+
+  /// Returns true if the Tic requires a CRC byte at the end of each serial
+  /// command.
+  bool getSerialCrcEnabled() const
+  {
+    return data[SettingOffset::SerialCrcEnabled] & 1;
+  }
+
+  /// Returns the current limit in milliamps.
+  ///
+  /// This uses the product that was specified with TicBase::setProduct() at
+  /// the time the settings were read.
+  uint16_t getCurrentLimit() const;
+
+  /// Returns the step mode.
+  TicStepMode getStepMode() const
+  {
+    return (TicStepMode)data[SettingOffset::StepMode];
+  }
+
+  /// Returns the decay mode.
+  TicDecayMode getDecayMode() const
+  {
+    return (TicDecayMode)data[SettingOffset::DecayMode];
+  }
+
+  /// Returns the starting speed in microsteps per 10000 seconds.
+  uint32_t getStartingSpeed() const
+  {
+    return read32(SettingOffset::StartingSpeed);
+  }
+
+  /// Returns the maximum speed in microsteps per 10000 seconds.
+  uint32_t getMaxSpeed() const
+  {
+    return read32(SettingOffset::SpeedMax);
+  }
+
+  /// Returns the maximum deceleration in microsteps per second per 100
+  /// seconds.
+  uint32_t getMaxDecel() const
+  {
+    return read32(SettingOffset::DecelMax);
+  }
+
+  /// Returns the maximum acceleration in microsteps per second per 100
+  /// seconds.
+  uint32_t getMaxAccel() const
+  {
+    return read32(SettingOffset::AccelMax);
+  }
+
+  /// Returns the raw bytes of the settings, for settings that this class
+  /// does not decode.  The array has ::TicSettingsSize bytes.
+  const uint8_t * getRawData() const
+  {
+    return data;
+  }
+
+private:
+  enum SettingOffset
+  {
+    ControlMode        = 0x01, // uint8_t
+    DisableSafeStart   = 0x03, // bool
+    SerialDeviceNumber = 0x07, // uint8_t
+    CommandTimeout     = 0x09, // uint16_t
+    SerialCrcEnabled   = 0x0B, // bool
+    CurrentLimit       = 0x40, // uint8_t
+    StepMode           = 0x41, // uint8_t
+    DecayMode          = 0x42, // uint8_t
+    StartingSpeed      = 0x43, // uint32_t
+    SpeedMax           = 0x47, // uint32_t
+    DecelMax           = 0x4B, // uint32_t
+    AccelMax           = 0x4F, // uint32_t
+  };
+
+  uint16_t read16(uint8_t offset) const
+  {
+    return ((uint16_t)data[offset] << 0) | ((uint16_t)data[offset + 1] << 8);
+  }
+
+  uint32_t read32(uint8_t offset) const
+  {
+    return ((uint32_t)read16(offset) << 0) |
+      ((uint32_t)read16(offset + 2) << 16);
+  }
+
+  uint8_t data[TicSettingsSize] = {};
+  TicProduct product = TicProduct::Unknown;
+
+  friend class TicBase;
+};
+
+/// The maximum number of bytes the Tic will return in response to a single
+/// "Get variable" or "Get setting" command.
+const uint8_t TicMaxSegmentLength = 15;
+
+/// This enum lists the variables in the block read by TicBase::getVariables(),
+/// in the order they are stored on the Tic.  It is used to build a
+/// ::TicVariableMask specifying which variables to read.
+enum class TicVariable : uint8_t
+{
+  OperationState = 0,
+  MiscFlags1,
+  ErrorStatus,
+  ErrorsOccurred,
+  PlanningMode,
+  TargetPosition,
+  TargetVelocity,
+  StartingSpeed,
+  SpeedMax,
+  DecelMax,
+  AccelMax,
+  CurrentPosition,
+  CurrentVelocity,
+  ActingTargetPosition,
+  TimeSinceLastStep,
+  DeviceReset,
+  VinVoltage,
+  UpTime,
+  EncoderPosition,
+  RCPulseWidth,
+  AnalogReadingSCL,
+  AnalogReadingSDA,
+  AnalogReadingTX,
+  AnalogReadingRX,
+  DigitalReadings,
+  PinStates,
+  StepMode,
+  CurrentLimit,
+  DecayMode,
+  InputState,
+  InputAfterAveraging,
+  InputAfterHysteresis,
+  InputAfterScaling,
+  LastMotorDriverError,
+  AgcMode,
+  AgcBottomCurrentLimit,
+  AgcCurrentBoostSteps,
+  AgcFrequencyLimit,
+};
+
+/// The number of entries in ::TicVariable.
+const uint8_t TicVariableCount = 38;
+
+/// A set of variables, with one bit for each ::TicVariable.  Use
+/// ticVariableBit() to build one.
+typedef uint64_t TicVariableMask;
+
+/// Returns the bit representing the specified variable in a ::TicVariableMask.
+///
+/// Example usage:
+/// ```
+/// const TicVariableMask mask =
+///   ticVariableBit(TicVariable::CurrentPosition) |
+///   ticVariableBit(TicVariable::CurrentVelocity) |
+///   ticVariableBit(TicVariable::MiscFlags1);
+/// ```
+constexpr TicVariableMask ticVariableBit(TicVariable variable)
+{
+  return (TicVariableMask)1 << (uint8_t)variable;
+}
+
+/// A ::TicVariableMask that includes every variable.
+const TicVariableMask TicAllVariables =
+  ((TicVariableMask)1 << TicVariableCount) - 1;
+
+/// The default number of unneeded bytes that the read planner will read in
+/// order to merge two reads into one.
+///
+/// Every extra transfer costs at least this much: a compact protocol serial
+/// request is three bytes plus the Tic's turnaround time, while an I2C read
+/// needs an address, command, offset, repeated start, and a second address.
+const uint8_t TicDefaultReadGap = 4;
+
+/// A contiguous range of variables to read with one "Get variable" command.
+struct TicReadRange
+{
+  uint8_t offset;
+  uint8_t length;
+};
+
+template <TicVariableMask mask, uint8_t gap> struct TicReadPlan;
+
+/// This class holds cached copies of the Tic's variables so that the getters
+/// in TicBase can return recent values without communicating with the Tic.
+/// To use it, create a TicVariableCache object and pass it to
+/// TicBase::setVariableCache().
+///
+/// Each variable remembers when it was read.  When a getter asks for a
+/// variable that is older than the maximum age, the cache reads it again,
+/// along with any other stale variables in the prefetch mask, using the same
+/// coalesced reads as TicBase::getVariables().  Variables outside the block
+/// read by getVariables() (TicBase::getLastHpDriverErrors()) and
+/// TicBase::getErrorsOccurred(), which clears the errors, are never cached.
+///
+/// Example usage:
+/// ```
+/// TicVariableCache ticCache(20);  // values can be up to 20 ms old
+///
+/// void setup()
+/// {
+///   tic.setVariableCache(&ticCache);
+/// }
+/// ```
+///
+/// The cache does not know when commands change the Tic's variables, so a
+/// getter can return a value from before the most recent command, such as an
+/// old target velocity, until the value expires.  Call invalidate() if you
+/// need fresh values right away.
+class TicVariableCache
+{
+public:
+  /// Creates a new cache.  The `maxAge` argument is the maximum age of a
+  /// cached value in milliseconds, and `prefetchMask` specifies which
+  /// variables to refresh together whenever one of them is stale.
+  TicVariableCache(uint16_t maxAge = 10,
+    TicVariableMask prefetchMask = TicAllVariables)
+    : maxAge(maxAge), prefetchMask(prefetchMask)
+  {
+  }
+
+  /// Sets the maximum age of a cached value in milliseconds.
+  void setMaxAge(uint16_t maxAge) { this->maxAge = maxAge; }
+
+  /// Gets the maximum age of a cached value in milliseconds.
+  uint16_t getMaxAge() { return maxAge; }
+
+  /// Sets which variables are refreshed together whenever one of them needs
+  /// to be read.  A smaller mask makes each refresh faster, while a larger
+  /// mask means fewer refreshes.
+  void setPrefetchMask(TicVariableMask mask) { prefetchMask = mask; }
+
+  /// Marks every cached value as stale.
+  void invalidate() { valid = 0; }
+
+  /// Returns the number of times a getter was served from the cache.
+  uint32_t getHits() { return hits; }
+
+  /// Returns the number of times a getter had to read from the Tic.
+  uint32_t getMisses() { return misses; }
+
+  /// Sets the hit and miss counters to zero.
+  void resetCounters() { hits = misses = 0; }
+
+private:
+  uint16_t maxAge;
+  TicVariableMask prefetchMask;
+  TicVariableMask valid = 0;
+  uint32_t hits = 0;
+  uint32_t misses = 0;
+  uint32_t readTimes[TicVariableCount];
+  uint8_t data[TicVariablesSize];
+
+  friend class TicBase;
+};
+
+/// This class remembers the last value sent with each of the Tic's "Set"
+/// commands so that TicBase can skip commands that would not change anything.
+/// To use it, create a TicCommandShadow object and pass it to
+/// TicBase::setCommandShadow().
+///
+/// The following functions are shadowed: TicBase::setTargetPosition(),
+/// TicBase::setTargetVelocity(), TicBase::setMaxSpeed(),
+/// TicBase::setStartingSpeed(), TicBase::setMaxAccel(),
+/// TicBase::setMaxDecel(), TicBase::setStepMode(), TicBase::setCurrentLimit(),
+/// TicBase::setDecayMode(), and the AGC setters.  When one of them is called
+/// with the value that was last sent successfully, no command is sent.
+///
+/// Example usage:
+/// ```
+/// TicCommandShadow ticShadow;
+///
+/// void setup()
+/// {
+///   tic.setCommandShadow(&ticShadow);
+/// }
+/// ```
+///
+/// The shadow is cleared when a command fails, when reset() is called, and
+/// when the Tic is seen to have reset itself: getUpTime() going backwards or
+/// getDeviceReset() changing.  Any other command, such as haltAndHold() or
+/// exitSafeStart(), clears the shadowed target position and target velocity,
+/// as does setting the other kind of target.  (resetCommandTimeout() is the
+/// exception, so TicKeepalive does not defeat the shadow.)
+///
+/// The shadow cannot see changes that the Tic makes on its own, such as
+/// clearing its target when an error occurs.  Call invalidateTargets() or
+/// invalidate() if you need the next command to be sent no matter what.
+///
+/// **Command timeout:** a skipped command does not reset the Tic's command
+/// timeout, so a program that keeps calling setTargetVelocity() with the same
+/// value could otherwise let the Tic stop with a "Command timeout" error.  To
+/// prevent this, a command that would be skipped is sent anyway if the Tic
+/// has not received a command for the refresh interval, which defaults to
+/// 500 ms (half of the Tic's default command timeout).  If you lower the
+/// Tic's command timeout, lower the refresh interval to match with
+/// setRefreshInterval().  If you disable the refresh, use TicKeepalive or
+/// call TicBase::resetCommandTimeout() regularly instead.
+class TicCommandShadow
+{
+public:
+  /// Sets how long, in milliseconds, the Tic can go without receiving a
+  /// command before a command that would be skipped is sent anyway.  This
+  /// should be well below the Tic's command timeout.  Pass 0 to always skip
+  /// redundant commands.
+  void setRefreshInterval(uint16_t interval) { refreshInterval = interval; }
+
+  /// Returns the interval set by setRefreshInterval().
+  uint16_t getRefreshInterval() { return refreshInterval; }
+
+  /// Forgets every remembered value, so that the next command of each kind
+  /// is sent.
+  void invalidate() { valid = 0; }
+
+  /// Forgets the remembered target position and target velocity.
+  void invalidateTargets()
+  {
+    valid &= ~(1 << TargetPosition | 1 << TargetVelocity);
+  }
+
+  /// Returns the number of commands that were skipped because they would not
+  /// have changed anything.
+  uint32_t getSkipped() { return skipped; }
+
+  /// Returns the number of shadowed commands that were sent.
+  uint32_t getSent() { return sent; }
+
+  /// Sets the skipped and sent counters to zero.
+  void resetCounters() { skipped = sent = 0; }
+
+private:
+  enum Slot
+  {
+    TargetPosition,
+    TargetVelocity,
+    SpeedMax,
+    StartingSpeed,
+    AccelMax,
+    DecelMax,
+    StepMode,
+    CurrentLimit,
+    DecayMode,
+    Agc,  // four slots, one per AGC option
+    SlotCount = Agc + 4,
+  };
+
+  static uint8_t slotFor(TicCommand cmd, uint32_t val);
+  bool isRedundant(TicCommand cmd, uint32_t val, uint16_t lastCommandTime);
+  void commandSent(TicCommand cmd, uint32_t val, uint8_t error);
+  void noteUpTime(uint32_t upTime);
+  void noteDeviceReset(uint8_t deviceReset);
+
+  uint16_t valid = 0;
+  uint16_t refreshInterval = 500;
+  uint32_t values[SlotCount];
+  uint32_t skipped = 0;
+  uint32_t sent = 0;
+  uint32_t lastUpTime = 0;
+  uint8_t lastDeviceReset = 0xFF;
+
+  friend class TicBase;
+  friend class TicCommandQueue;
+};
+
+#ifdef TIC_INSTRUMENTATION
+
+/// The number of latency buckets kept by TicStats.
+const uint8_t TicStatsLatencyBuckets = 8;
+
+/// This class collects statistics about the communication with one or more
+/// Tics: how many times each command was sent, how many bytes were sent and
+/// received, how many transfers failed with each error code, and a histogram
+/// of how long transfers took.  To use it, create a TicStats object and pass
+/// it to TicBase::setStats().
+///
+/// This class only exists if `TIC_INSTRUMENTATION` is defined when compiling
+/// the library, for example by adding `-DTIC_INSTRUMENTATION` to the build
+/// flags.  Without it, the library has no instrumentation code, and TicBase
+/// only keeps an unused pointer.  The macro must be defined for the library's
+/// own source files, not just for your sketch: defining it only in the sketch
+/// leaves TicStats undefined at link time.
+///
+/// Example usage:
+/// ```
+/// TicStats ticStats;
+///
+/// void setup()
+/// {
+///   tic.setStats(&ticStats);
+/// }
+///
+/// void loop()
+/// {
+///   ...
+///   Serial.println(ticStats.getErrorCount(50));
+/// }
+/// ```
+///
+/// Commands and reads done by TicSerial and TicI2C are recorded, including
+/// each retry of a failed serial read and commands sent with
+/// TicSerial::sendFrame().  Non-blocking reads, TicSerialBatch, and
+/// TicSerialGroup are not recorded.
+///
+/// Byte counts include the Pololu protocol header and CRC bytes for serial,
+/// and the data bytes of each I2C transfer (but not the address bytes).
+/// Bytes are only counted as received for reads that succeed.
+class TicStats
+{
+public:
+  /// The type of a function that returns the current time, like `micros()`.
+  typedef unsigned long (*Clock)();
+
+  /// Creates a new object.  The `clock` argument is the function used to
+  /// time transfers, which determines the units of the latency histogram:
+  /// the default is `micros()`, so the units are microseconds.
+  TicStats(Clock clock = micros) : clock(clock)
+  {
+    reset();
+  }
+
+  /// Sets the function used to time transfers.
+  void setClock(Clock clock) { this->clock = clock; }
+
+  /// Sets every counter to zero.
+  void reset();
+
+  /// Returns the number of times the specified command was sent.  This
+  /// includes reads, which are done with TicCommand::GetVariable,
+  /// TicCommand::GetVariableAndClearErrorsOccurred, and
+  /// TicCommand::GetSetting.  A read that is split into several requests
+  /// counts once per request.
+  uint32_t getCount(TicCommand cmd);
+
+  /// Returns the number of bytes sent.
+  uint32_t getBytesSent() { return bytesSent; }
+
+  /// Returns the number of bytes received.
+  uint32_t getBytesReceived() { return bytesReceived; }
+
+  /// Returns the number of transfers that failed with the specified error
+  /// code (see TicBase::getLastError()).  Codes 1 through 5 come from the
+  /// I2C library, 50 means a serial read timed out or was short, and 51
+  /// means a serial response had a bad CRC.  Any other codes are counted
+  /// together, and passing one of them returns that total.
+  uint32_t getErrorCount(uint8_t error);
+
+  /// Returns the total number of failed transfers.
+  uint32_t getErrorTotal();
+
+  /// Returns the number of transfers whose latency fell in the specified
+  /// bucket.  See getLatencyLimit().
+  uint32_t getLatencyCount(uint8_t bucket)
+  {
+    return bucket < TicStatsLatencyBuckets ? latency[bucket] : 0;
+  }
+
+  /// Returns the upper limit of the specified latency bucket, in the units
+  /// of the clock.  Bucket 0 counts latencies below 250, and each bucket's
+  /// limit is twice the previous one's.  The last bucket has no limit, and
+  /// this function returns 0xFFFFFFFF for it.
+  static uint32_t getLatencyLimit(uint8_t bucket)
+  {
+    if (bucket >= TicStatsLatencyBuckets - 1) { return 0xFFFFFFFF; }
+    return (uint32_t)250 << bucket;
+  }
+
+private:
+  static const uint8_t commandCount = 23;
+  static const uint8_t errorSlots = 8;
+
+  static uint8_t commandIndex(TicCommand cmd);
+  static uint8_t errorIndex(uint8_t error);
+
+  uint32_t now() { return clock(); }
+  void record(TicCommand cmd, uint8_t error, uint32_t start,
+    uint8_t sent, uint8_t received);
+
+  Clock clock;
+  uint32_t counts[commandCount];
+  uint32_t errors[errorSlots];
+  uint32_t latency[TicStatsLatencyBuckets];
+  uint32_t bytesSent;
+  uint32_t bytesReceived;
+
+  friend class TicBase;
+};
+
+#else
+
+class TicStats;
+
+#endif
+
 /// This is a base class used to represent a connection to a Tic.  This class
 /// provides high-level functions for sending commands to the Tic and reading
 /// data from it.
@@ -344,7 +1102,7 @@ public:
   /// See also getTargetPosition().
   void setTargetPosition(int32_t position)
   {
-    commandW32(TicCommand::SetTargetPosition, position);
+    sendW32(TicCommand::SetTargetPosition, position);
   }
 
   /// Sets the target velocity of the Tic, in microsteps per 10000 seconds.
@@ -364,7 +1122,7 @@ public:
   /// See also getTargetVelocity().
   void setTargetVelocity(int32_t velocity)
   {
-    commandW32(TicCommand::SetTargetVelocity, velocity);
+    sendW32(TicCommand::SetTargetVelocity, velocity);
   }
 
   /// Stops the motor abruptly without respecting the deceleration limit and
@@ -385,7 +1143,7 @@ public:
   /// be silently ignored.
   void haltAndSetPosition(int32_t position)
   {
-    commandW32(TicCommand::HaltAndSetPosition, position);
+    sendW32(TicCommand::HaltAndSetPosition, position);
   }
 
   /// Stops the motor abruptly without respecting the deceleration limit.
@@ -406,7 +1164,7 @@ public:
   /// See also deenergize().
   void haltAndHold()
   {
-    commandQuick(TicCommand::HaltAndHold);
+    sendQuick(TicCommand::HaltAndHold);
   }
 
   /// Tells the Tic to start its homing procedure in the reverse direction.
@@ -416,7 +1174,7 @@ public:
   /// See also goHomeForward().
   void goHomeReverse()
   {
-    commandW7(TicCommand::GoHome, 0);
+    sendW7(TicCommand::GoHome, 0);
   }
 
   /// Tells the Tic to start its homing procedure in the forward direction.
@@ -426,7 +1184,7 @@ public:
   /// See also goHomeReverse().
   void goHomeForward()
   {
-    commandW7(TicCommand::GoHome, 1);
+    sendW7(TicCommand::GoHome, 1);
   }
 
   /// Prevents the "Command timeout" error from happening for some time.
@@ -439,7 +1197,7 @@ public:
   /// This function sends a "Reset command timeout" command to the Tic.
   void resetCommandTimeout()
   {
-    commandQuick(TicCommand::ResetCommandTimeout);
+    sendQuick(TicCommand::ResetCommandTimeout);
   }
 
   /// De-energizes the stepper motor coils.
@@ -463,7 +1221,7 @@ public:
   /// See also haltAndHold().
   void deenergize()
   {
-    commandQuick(TicCommand::Deenergize);
+    sendQuick(TicCommand::Deenergize);
   }
 
   /// Sends the Energize command.
@@ -478,7 +1236,7 @@ public:
   /// this allows the system to start up.
   void energize()
   {
-    commandQuick(TicCommand::Energize);
+    sendQuick(TicCommand::Energize);
   }
 
   /// Sends the "Exit safe start" command.
@@ -493,7 +1251,7 @@ public:
   /// this allows the system to start up.
   void exitSafeStart()
   {
-    commandQuick(TicCommand::ExitSafeStart);
+    sendQuick(TicCommand::ExitSafeStart);
   }
 
   /// Sends the "Enter safe start" command.
@@ -513,7 +1271,7 @@ public:
   /// the other control modes.
   void enterSafeStart()
   {
-    commandQuick(TicCommand::EnterSafeStart);
+    sendQuick(TicCommand::EnterSafeStart);
   }
 
   /// Sends the Reset command.
@@ -527,7 +1285,9 @@ public:
   /// more information, see the Tic user's guide.
   void reset()
   {
-    commandQuick(TicCommand::Reset);
+    sendQuick(TicCommand::Reset);
+    if (_cache) { _cache->invalidate(); }
+    if (_shadow) { _shadow->invalidate(); }
 
     // The Tic's serial and I2C interfaces will be unreliable for a brief period
     // after the Tic receives the Reset command, so we delay 10 ms here.
@@ -545,7 +1305,7 @@ public:
   /// information, see the Tic user's guide.
   void clearDriverError()
   {
-    commandQuick(TicCommand::ClearDriverError);
+    sendQuick(TicCommand::ClearDriverError);
   }
 
   /// Temporarily sets the maximum speed, in units of steps per 10000 seconds.
@@ -561,7 +1321,7 @@ public:
   /// See also getMaxSpeed().
   void setMaxSpeed(uint32_t speed)
   {
-    commandW32(TicCommand::SetSpeedMax, speed);
+    sendW32(TicCommand::SetSpeedMax, speed);
   }
 
   /// Temporarily sets the starting speed, in units of steps per 10000 seconds.
@@ -577,7 +1337,7 @@ public:
   /// See also getStartingSpeed().
   void setStartingSpeed(uint32_t speed)
   {
-    commandW32(TicCommand::SetStartingSpeed, speed);
+    sendW32(TicCommand::SetStartingSpeed, speed);
   }
 
   /// Temporarily sets the maximum acceleration, in units of steps per second
@@ -594,7 +1354,7 @@ public:
   /// See also getMaxAccel().
   void setMaxAccel(uint32_t accel)
   {
-    commandW32(TicCommand::SetAccelMax, accel);
+    sendW32(TicCommand::SetAccelMax, accel);
   }
 
   /// Temporarily sets the maximum deceleration, in units of steps per second
@@ -611,7 +1371,7 @@ public:
   /// See also getMaxDecel().
   void setMaxDecel(uint32_t decel)
   {
-    commandW32(TicCommand::SetDecelMax, decel);
+    sendW32(TicCommand::SetDecelMax, decel);
   }
 
   /// Temporarily sets the stepper motor's step mode, which defines how many
@@ -628,7 +1388,7 @@ public:
   /// See also getStepMode().
   void setStepMode(TicStepMode mode)
   {
-    commandW7(TicCommand::SetStepMode, (uint8_t)mode);
+    sendW7(TicCommand::SetStepMode, (uint8_t)mode);
   }
 
   /// Temporarily sets the stepper motor coil current limit in milliamps.  If
@@ -653,6 +1413,28 @@ public:
   /// See also getCurrentLimit().
   void setCurrentLimit(uint16_t limit);
 
+  /// Same as setCurrentLimit(uint16_t), except the type of Tic is given at
+  /// compile time instead of by setProduct(), so the conversion does not
+  /// depend on it at run time.
+  ///
+  /// Example usage:
+  /// ```
+  /// tic.setCurrentLimit<TicProduct::Tic36v4>(2000);  // 2000 mA
+  /// ```
+  template <TicProduct product>
+  void setCurrentLimit(uint16_t limit)
+  {
+    setCurrentLimitCode(TicCurrentLimit<product>::toCode(limit));
+  }
+
+  /// Temporarily sets the stepper motor coil current limit, using the Tic's
+  /// current limit code instead of milliamps.  See TicCurrentLimit for
+  /// converting milliamps to a code at compile time.
+  void setCurrentLimitCode(uint8_t code)
+  {
+    sendW7(TicCommand::SetCurrentLimit, code);
+  }
+
   /// Temporarily sets the stepper motor driver's decay mode.
   ///
   /// Example usage:
@@ -665,7 +1447,7 @@ public:
   /// See also getDecayMode().
   void setDecayMode(TicDecayMode mode)
   {
-    commandW7(TicCommand::SetDecayMode, (uint8_t)mode);
+    sendW7(TicCommand::SetDecayMode, (uint8_t)mode);
   }
 
   /// Temporarily sets the AGC mode.
@@ -675,7 +1457,7 @@ public:
   /// See also getAgcMode().
   void setAgcMode(TicAgcMode mode)
   {
-    commandW7(TicCommand::SetAgcOption, (uint8_t)mode & 0xF);
+    sendW7(TicCommand::SetAgcOption, (uint8_t)mode & 0xF);
   }
 
   /// Temporarily sets the AGC bottom current limit.
@@ -685,7 +1467,7 @@ public:
   /// See also getAgcBottomCurrentLimit().
   void setAgcBottomCurrentLimit(TicAgcBottomCurrentLimit limit)
   {
-    commandW7(TicCommand::SetAgcOption, 0x10 | ((uint8_t)limit & 0xF));
+    sendW7(TicCommand::SetAgcOption, 0x10 | ((uint8_t)limit & 0xF));
   }
 
   /// Temporarily sets the AGC current boost steps.
@@ -695,7 +1477,7 @@ public:
   /// See also getAgcCurrentBoostSteps().
   void setAgcCurrentBoostSteps(TicAgcCurrentBoostSteps steps)
   {
-    commandW7(TicCommand::SetAgcOption, 0x20 | ((uint8_t)steps & 0xF));
+    sendW7(TicCommand::SetAgcOption, 0x20 | ((uint8_t)steps & 0xF));
   }
 
   /// Temporarily sets the AGC frequency limit.
@@ -705,7 +1487,7 @@ public:
   /// See also getAgcFrequencyLimit().
   void setAgcFrequencyLimit(TicAgcFrequencyLimit limit)
   {
-    commandW7(TicCommand::SetAgcOption, 0x30 | ((uint8_t)limit & 0xF));
+    sendW7(TicCommand::SetAgcOption, 0x30 | ((uint8_t)limit & 0xF));
   }
 
   /// Gets the Tic's current operation state, which indicates whether it is
@@ -977,7 +1759,9 @@ public:
   /// The Reset command (reset()) does not affect this variable.
   TicReset getDeviceReset()
   {
-    return (TicReset)getVar8(VarOffset::DeviceReset);
+    uint8_t deviceReset = getVar8(VarOffset::DeviceReset);
+    if (_shadow && _lastError == 0) { _shadow->noteDeviceReset(deviceReset); }
+    return (TicReset)deviceReset;
   }
 
   /// Gets the current measurement of the VIN voltage, in millivolts.
@@ -1002,7 +1786,9 @@ public:
   /// A Reset command (reset())does not count.
   uint32_t getUpTime()
   {
-    return getVar32(VarOffset::UpTime);
+    uint32_t upTime = getVar32(VarOffset::UpTime);
+    if (_shadow && _lastError == 0) { _shadow->noteUpTime(upTime); }
+    return upTime;
   }
 
   /// Gets the raw encoder count measured from the Tic's RX and TX lines.
@@ -1122,6 +1908,21 @@ public:
   /// See also setCurrentLimit().
   uint16_t getCurrentLimit();
 
+  /// Same as getCurrentLimit(), except the type of Tic is given at compile
+  /// time instead of by setProduct().
+  template <TicProduct product>
+  uint16_t getCurrentLimit()
+  {
+    return TicCurrentLimit<product>::fromCode(getCurrentLimitCode());
+  }
+
+  /// Gets the stepper motor coil current limit as the Tic's current limit
+  /// code.  See TicCurrentLimit for converting it to milliamps.
+  uint8_t getCurrentLimitCode()
+  {
+    return getVar8(VarOffset::CurrentLimit);
+  }
+
   /// Gets the current decay mode of the stepper motor driver.
   ///
   /// Example usage:
@@ -1249,25 +2050,201 @@ public:
     return getVar8(VarOffset::LastHpDriverErrors);
   }
 
-  /// Gets a contiguous block of settings from the Tic's EEPROM.
-  ///
-  /// The maximum length that can be fetched is 15 bytes.
+  /// Reads all of the Tic's variables at once and stores them in the specified
+  /// TicVariables struct.
   ///
   /// Example usage:
   /// ```
-  /// // Get the Tic's serial device number.
-  /// uint8_t deviceNumber;
-  /// tic.getSetting(7, 1, &deviceNumber);
+  /// TicVariables vars;
+  /// tic.getVariables(vars);
+  /// if (vars.operationState == TicOperationState::Normal)
+  /// {
+  ///   Serial.println(vars.currentPosition);
+  /// }
   /// ```
   ///
-  /// This library does not attempt to interpret the settings and say what they
-  /// mean.  If you are interested in how the settings are encoded in the Tic's
-  /// EEPROM, see the "Settings reference" section of the Tic user's guide.
-  void getSetting(uint8_t offset, uint8_t length, uint8_t * buffer)
-  {
-    getSegment(TicCommand::GetSetting, offset, length, buffer);
+  /// This is much faster than calling several of the individual getters,
+  /// each of which performs its own transfer, because the whole block of
+  /// variables is fetched using the smallest number of "Get variable" commands
+  /// that the Tic allows.
+  ///
+  /// If there is a communication error, this function stops early and the
+  /// variables that could not be read are set to zero.  Use getLastError() to
+  /// check for errors.
+  void getVariables(TicVariables & vars);
+
+  /// Reads only the specified variables and stores them in the TicVariables
+  /// struct.  The members for other variables are set to zero.
+  ///
+  /// The variables are fetched using the smallest set of contiguous reads that
+  /// covers them, where two nearby reads are merged if there are at most `gap`
+  /// unneeded bytes between them.
+  ///
+  /// Example usage:
+  /// ```
+  /// TicVariables vars;
+  /// tic.getVariables(vars, ticVariableBit(TicVariable::CurrentPosition) |
+  ///   ticVariableBit(TicVariable::CurrentVelocity));
+  /// ```
+  ///
+  /// If the mask is a constant, the templated version of this function is
+  /// better because it plans the reads at compile time.
+  void getVariables(TicVariables & vars, TicVariableMask mask,
+    uint8_t gap = TicDefaultReadGap);
+
+  /// Reads only the specified variables, like the non-templated
+  /// getVariables(TicVariables &, TicVariableMask, uint8_t) function, except
+  /// that the reads are planned at compile time.
+  ///
+  /// Example usage:
+  /// ```
+  /// const TicVariableMask statusMask =
+  ///   ticVariableBit(TicVariable::CurrentPosition) |
+  ///   ticVariableBit(TicVariable::CurrentVelocity) |
+  ///   ticVariableBit(TicVariable::MiscFlags1);
+  ///
+  /// TicVariables vars;
+  /// tic.getVariables<statusMask>(vars);
+  /// ```
+  template <TicVariableMask mask, uint8_t gap = TicDefaultReadGap>
+  void getVariables(TicVariables & vars)
+  {
+    uint8_t buffer[TicVariablesSize];
+    readRanges(TicReadPlan<mask, gap>::ranges,
+      TicReadPlan<mask, gap>::count, buffer);
+    decodeVariables(buffer, vars);
+  }
+
+  /// Gets a contiguous block of settings from the Tic's EEPROM.
+  ///
+  /// The Tic returns at most 15 bytes per request, so longer blocks are
+  /// fetched with several requests (see readBlock()).
+  ///
+  /// Example usage:
+  /// ```
+  /// // Get the Tic's serial device number.
+  /// uint8_t deviceNumber;
+  /// tic.getSetting(7, 1, &deviceNumber);
+  /// ```
+  ///
+  /// This library does not attempt to interpret the settings and say what they
+  /// mean.  If you are interested in how the settings are encoded in the Tic's
+  /// EEPROM, see the "Settings reference" section of the Tic user's guide.
+  void getSetting(uint8_t offset, uint8_t length, uint8_t * buffer)
+  {
+    readBlock(TicCommand::GetSetting, offset, length, buffer);
+  }
+
+  /// Reads the Tic's settings and stores them in the specified TicSettings
+  /// object, so they can be looked up later without communicating with the
+  /// Tic.
+  ///
+  /// Example usage:
+  /// ```
+  /// TicSettings settings;
+  ///
+  /// void setup()
+  /// {
+  ///   tic.reloadSettings(settings);
+  /// }
+  /// ```
+  ///
+  /// The settings only change when they are written with the Tic Control
+  /// Center or when the Tic is reconfigured some other way, so this usually
+  /// only needs to be called once at startup.  Use getLastError() to check for
+  /// errors.
+  void reloadSettings(TicSettings & settings)
+  {
+    readBlock(TicCommand::GetSetting, 0, TicSettingsSize, settings.data);
+    settings.product = product;
+  }
+
+  /// Makes the getters use the specified cache, so that repeated calls within
+  /// the cache's maximum age do not communicate with the Tic.  Pass `nullptr`
+  /// to stop using a cache.
+  ///
+  /// See TicVariableCache for details.
+  void setVariableCache(TicVariableCache * cache)
+  {
+    _cache = cache;
+  }
+
+  /// Returns the cache specified with setVariableCache(), or `nullptr`.
+  TicVariableCache * getVariableCache()
+  {
+    return _cache;
+  }
+
+  /// Makes the setters skip commands that would not change anything.  Pass
+  /// `nullptr` to send every command.
+  ///
+  /// See TicCommandShadow for details.
+  void setCommandShadow(TicCommandShadow * shadow)
+  {
+    _shadow = shadow;
+  }
+
+  /// Returns the shadow specified with setCommandShadow(), or `nullptr`.
+  TicCommandShadow * getCommandShadow()
+  {
+    return _shadow;
+  }
+
+  /// Records statistics about the communication with this Tic in the
+  /// specified object.  Pass `nullptr` to stop.  Several Tics can share one
+  /// TicStats object.
+  ///
+  /// Nothing is recorded unless `TIC_INSTRUMENTATION` is defined.  See
+  /// TicStats for details.
+  void setStats(TicStats * stats)
+  {
+    _stats = stats;
+  }
+
+  /// Returns the object specified with setStats(), or `nullptr`.
+  TicStats * getStats()
+  {
+    return _stats;
   }
 
+  /// Sends any command that does not read from the Tic.  This is useful for
+  /// code that stores commands to send later, like TicCommandQueue.
+  ///
+  /// The `val` argument is the command's data, as it would be sent to the
+  /// Tic.  For example, for TicCommand::SetCurrentLimit it is a current limit
+  /// code rather than milliamps, and for TicCommand::SetStepMode it is a
+  /// ::TicStepMode value.  It is ignored for commands that take no data.
+  /// TicCommand::Reset calls reset(), and the Get commands are ignored.
+  ///
+  /// Example usage:
+  /// ```
+  /// tic.sendCommand(TicCommand::SetTargetVelocity, 2000000);
+  /// tic.sendCommand(TicCommand::Energize);
+  /// ```
+  void sendCommand(TicCommand cmd, uint32_t val = 0);
+
+  /// Reads a contiguous block of variables or settings of any length.
+  ///
+  /// The `cmd` argument should be TicCommand::GetVariable or
+  /// TicCommand::GetSetting.
+  ///
+  /// The block is split into the largest reads allowed by the Tic and by the
+  /// transport being used: the Tic returns at most ::TicMaxSegmentLength bytes
+  /// per request, and TicI2C is also limited by the size of the I2C library's
+  /// receive buffer.
+  ///
+  /// Example usage:
+  /// ```
+  /// // Read the first 64 bytes of the Tic's settings.
+  /// uint8_t settings[64];
+  /// tic.readBlock(TicCommand::GetSetting, 0, sizeof(settings), settings);
+  /// ```
+  ///
+  /// If one of the reads fails, this function stops and sets the rest of the
+  /// buffer to zero.  Use getLastError() to check for errors.
+  void readBlock(TicCommand cmd, uint8_t offset, uint8_t length,
+    void * buffer);
+
   /// Returns 0 if the last communication with the device was successful, and
   /// non-zero if there was an error.
   uint8_t getLastError()
@@ -1275,11 +2252,60 @@ public:
     return _lastError;
   }
 
+  /// Returns the lower 16 bits of `millis()` at the time the last command was
+  /// successfully sent to the Tic.  Reads do not count.
+  ///
+  /// Every command resets the Tic's command timeout, so this is used by
+  /// TicKeepalive to avoid sending unnecessary "Reset command timeout"
+  /// commands.
+  uint16_t getLastCommandTime()
+  {
+    return _lastCommandTime;
+  }
+
 protected:
   /// Zero if the last communication with the device was successful, non-zero
   /// otherwise.
   uint8_t _lastError = 0;
 
+  /// See getLastCommandTime().
+  uint16_t _lastCommandTime = 0;
+
+  /// Subclasses call this after sending a command.
+  void recordCommand()
+  {
+    if (_lastError == 0) { _lastCommandTime = millis(); }
+  }
+
+  /// Subclasses call statsStart() before a transfer and pass its result to
+  /// statsRecord() afterwards, along with the number of bytes sent and
+  /// received.  These do nothing unless `TIC_INSTRUMENTATION` is defined.
+  uint32_t statsStart()
+  {
+#ifdef TIC_INSTRUMENTATION
+    if (_stats) { return _stats->now(); }
+#endif
+    return 0;
+  }
+
+  void statsRecord(TicCommand cmd, uint32_t start, uint8_t sent,
+    uint8_t received)
+  {
+#ifdef TIC_INSTRUMENTATION
+    if (_stats)
+    {
+      _stats->record(cmd, _lastError, start, sent, _lastError ? 0 : received);
+    }
+#else
+    (void)cmd; (void)start; (void)sent; (void)received;
+#endif
+  }
+
+  /// These send a command through the TicCommandShadow, if there is one.
+  void sendQuick(TicCommand cmd);
+  void sendW32(TicCommand cmd, uint32_t val);
+  void sendW7(TicCommand cmd, uint8_t val);
+
 private:
   enum VarOffset
   {
@@ -1324,155 +2350,1865 @@ private:
     LastHpDriverErrors    = 0xFF, // uint8_t
   };
 
+  static uint16_t read16(const uint8_t * buffer)
+  {
+    return ((uint16_t)buffer[0] << 0) | ((uint16_t)buffer[1] << 8);
+  }
+
+  static uint32_t read32(const uint8_t * buffer)
+  {
+    return ((uint32_t)buffer[0] << 0) |
+      ((uint32_t)buffer[1] << 8) |
+      ((uint32_t)buffer[2] << 16) |
+      ((uint32_t)buffer[3] << 24);
+  }
+
+  void getVar(uint8_t offset, uint8_t length, void * buffer)
+  {
+    if (_cache && offset < TicVariablesSize)
+    {
+      getCachedVar(offset, length, buffer);
+    }
+    else
+    {
+      getSegment(TicCommand::GetVariable, offset, length, buffer);
+    }
+  }
+
   uint8_t getVar8(uint8_t offset)
   {
     uint8_t result;
-    getSegment(TicCommand::GetVariable, offset, 1, &result);
+    getVar(offset, 1, &result);
     return result;
   }
 
   uint16_t getVar16(uint8_t offset)
   {
     uint8_t buffer[2];
-    getSegment(TicCommand::GetVariable, offset, 2, &buffer);
-    return ((uint16_t)buffer[0] << 0) | ((uint16_t)buffer[1] << 8);
+    getVar(offset, 2, buffer);
+    return read16(buffer);
   }
 
   uint32_t getVar32(uint8_t offset)
   {
     uint8_t buffer[4];
-    getSegment(TicCommand::GetVariable, offset, 4, buffer);
-    return ((uint32_t)buffer[0] << 0) |
-      ((uint32_t)buffer[1] << 8) |
-      ((uint32_t)buffer[2] << 16) |
-      ((uint32_t)buffer[3] << 24);
+    getVar(offset, 4, buffer);
+    return read32(buffer);
   }
 
+  void getCachedVar(uint8_t offset, uint8_t length, void * buffer);
+  TicVariableMask readVariables(TicVariableMask mask, uint8_t gap,
+    uint8_t * buffer);
+
+  uint16_t currentLimitFromCode(uint8_t code)
+  {
+    return currentLimitFromCode(product, code);
+  }
+
+  static uint16_t currentLimitFromCode(TicProduct product, uint8_t code);
+  void readRanges(const TicReadRange * ranges, uint8_t count,
+    uint8_t * buffer);
+  void decodeVariables(const uint8_t * buffer, TicVariables & vars);
+
   virtual void commandQuick(TicCommand cmd) = 0;
   virtual void commandW32(TicCommand cmd, uint32_t val) = 0;
   virtual void commandW7(TicCommand cmd, uint8_t val) = 0;
   virtual void getSegment(TicCommand cmd, uint8_t offset,
-    uint8_t length, void * buffer);
+    uint8_t length, void * buffer) = 0;
+  virtual uint8_t maxSegmentLength() { return TicMaxSegmentLength; }
 
   TicProduct product = TicProduct::Unknown;
+  TicVariableCache * _cache = nullptr;
+  TicCommandShadow * _shadow = nullptr;
+
+  // This is kept even without TIC_INSTRUMENTATION so that the layout of
+  // TicBase does not depend on the macro.
+  TicStats * _stats = nullptr;
+
+  friend class TicReadPlanner;
+  friend class TicSettings;
+  friend class TicSerialGroup;
 };
 
-/// Represents a serial connection to a Tic.
+/// This class plans the reads needed to fetch a set of variables.  It is used
+/// by TicBase::getVariables(), and you should not need to use it directly.
 ///
-/// For the high-level commands you can use on this object, see TicBase.
-class TicSerial : public TicBase
+/// All of its functions are constexpr, so when the mask is a constant the
+/// plan is computed by the compiler.
+class TicReadPlanner
 {
 public:
-  /// Creates a new TicSerial object.
-  ///
-  /// The `stream` argument should be a hardware or software serial object.
-  /// This class will store a pointer to it and use it to communicate with the
-  /// Tic.  You should initialize it and set it to use the correct baud rate
-  /// before sending commands with this class.
-  ///
-  /// The `deviceNumber` argument is optional.  If it is omitted or 255, the
-  /// TicSerial object will use the compact protocol.  If it is a number between
-  /// 0 and 127, it specifies the device number to use in Pololu protocol,
-  /// allowing you to control multiple Tic controllers on a single serial bus.
-  ///
-  /// For example, to use the first open hardware serial port to send compact
-  /// protocol commands to one Tic, write this at the top of your sketch:
-  /// ```
-  /// TicSerial tic(SERIAL_PORT_HARDWARE_OPEN);
-  /// ```
-  ///
-  /// For example, to use a SoftwareSerial port and send Pololu protocol
-  /// commands to two different Tic controllers, write this at the top of your sketch:
-  ///
-  /// ```
-  /// #include <SoftwareSerial.h>
-  /// SoftwareSerial ticSerial(10, 11);
-  /// TicSerial tic1(ticSerial, 14);
-  /// TicSerial tic2(ticSerial, 15);
-  /// ```
-  TicSerial(Stream & stream, uint8_t deviceNumber = 255) :
-    _stream(&stream),
-    _deviceNumber(deviceNumber)
+  /// Returns the number of reads needed to fetch the variables in `mask`.
+  static constexpr uint8_t count(TicVariableMask mask, uint8_t gap)
   {
+    return countFrom(mask, gap, next(mask, 0));
   }
 
-  /// Gets the serial device number specified in the constructor.
-  uint8_t getDeviceNumber() { return _deviceNumber; }
+  /// Returns the read with the specified index in the plan for `mask`.
+  static constexpr TicReadRange range(TicVariableMask mask, uint8_t gap,
+    uint8_t index)
+  {
+    return rangeFrom(mask, gap, index, next(mask, 0));
+  }
+
+  /// Returns the index of the first variable in `mask` at or after `i`, or
+  /// TicVariableCount if there is none.
+  static constexpr uint8_t next(TicVariableMask mask, uint8_t i)
+  {
+    return (i >= TicVariableCount || (mask >> i & 1)) ? i : next(mask, i + 1);
+  }
+
+  /// Returns true if a read that starts at variable `first` and currently ends
+  /// at variable `last` should be extended to include variable `candidate`.
+  static constexpr bool extends(uint8_t first, uint8_t last,
+    uint8_t candidate, uint8_t gap)
+  {
+    return candidate < TicVariableCount &&
+      end(candidate) - offsets[first] <= TicMaxSegmentLength &&
+      offsets[candidate] - end(last) <= gap;
+  }
+
+  /// Returns the index of the last variable in the read that starts at
+  /// variable `first`.
+  static constexpr uint8_t last(TicVariableMask mask, uint8_t gap,
+    uint8_t first, uint8_t current)
+  {
+    return extends(first, current, next(mask, current + 1), gap) ?
+      last(mask, gap, first, next(mask, current + 1)) : current;
+  }
+
+  /// Returns the offset one past the end of the specified variable.
+  static constexpr uint8_t end(uint8_t i)
+  {
+    return offsets[i] + sizes[i];
+  }
+
+  /// The offset of each ::TicVariable.
+  static constexpr uint8_t offsets[TicVariableCount] = {
+    TicBase::OperationState,
+    TicBase::MiscFlags1,
+    TicBase::ErrorStatus,
+    TicBase::ErrorsOccurred,
+    TicBase::PlanningMode,
+    TicBase::TargetPosition,
+    TicBase::TargetVelocity,
+    TicBase::StartingSpeed,
+    TicBase::SpeedMax,
+    TicBase::DecelMax,
+    TicBase::AccelMax,
+    TicBase::CurrentPosition,
+    TicBase::CurrentVelocity,
+    TicBase::ActingTargetPosition,
+    TicBase::TimeSinceLastStep,
+    TicBase::DeviceReset,
+    TicBase::VinVoltage,
+    TicBase::UpTime,
+    TicBase::EncoderPosition,
+    TicBase::RCPulseWidth,
+    TicBase::AnalogReadingSCL,
+    TicBase::AnalogReadingSDA,
+    TicBase::AnalogReadingTX,
+    TicBase::AnalogReadingRX,
+    TicBase::DigitalReadings,
+    TicBase::PinStates,
+    TicBase::StepMode,
+    TicBase::CurrentLimit,
+    TicBase::DecayMode,
+    TicBase::InputState,
+    TicBase::InputAfterAveraging,
+    TicBase::InputAfterHysteresis,
+    TicBase::InputAfterScaling,
+    TicBase::LastMotorDriverError,
+    TicBase::AgcMode,
+    TicBase::AgcBottomCurrentLimit,
+    TicBase::AgcCurrentBoostSteps,
+    TicBase::AgcFrequencyLimit,
+  };
+
+  /// The size in bytes of each ::TicVariable.
+  static constexpr uint8_t sizes[TicVariableCount] = {
+    1, 1, 2, 4, 1, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 1, 2, 4, 4, 2,
+    2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 2, 2, 4, 1, 1, 1, 1, 1,
+  };
 
 private:
-  Stream * const _stream;
-  const uint8_t _deviceNumber;
+  static constexpr uint8_t countFrom(TicVariableMask mask, uint8_t gap,
+    uint8_t first)
+  {
+    return first >= TicVariableCount ? 0 :
+      1 + countFrom(mask, gap, next(mask, last(mask, gap, first, first) + 1));
+  }
 
-  void commandQuick(TicCommand cmd) { sendCommandHeader(cmd); }
-  void commandW32(TicCommand cmd, uint32_t val);
-  void commandW7(TicCommand cmd, uint8_t val);
-  uint8_t commandR8(TicCommand cmd);
-  void getSegment(TicCommand cmd, uint8_t offset,
-    uint8_t length, void * buffer);
+  static constexpr TicReadRange rangeFrom(TicVariableMask mask, uint8_t gap,
+    uint8_t index, uint8_t first)
+  {
+    return index == 0 ?
+      TicReadRange { offsets[first],
+        (uint8_t)(end(last(mask, gap, first, first)) - offsets[first]) } :
+      rangeFrom(mask, gap, index - 1,
+        next(mask, last(mask, gap, first, first) + 1));
+  }
+};
+
+/// \cond
+
+template <uint8_t... I> struct TicIndexList {};
 
-  void sendCommandHeader(TicCommand cmd);
-  void serialW7(uint8_t val) { _stream->write((uint8_t)(val & 0x7F)); }
+template <uint8_t N, uint8_t... I> struct TicMakeIndexList
+  : TicMakeIndexList<N - 1, N - 1, I...> {};
+
+template <uint8_t... I> struct TicMakeIndexList<0, I...>
+{
+  typedef TicIndexList<I...> type;
 };
 
-/// Represents an I2C connection to a Tic.
+template <TicVariableMask mask, uint8_t gap, class List>
+struct TicReadPlanRanges;
+
+template <TicVariableMask mask, uint8_t gap, uint8_t... I>
+struct TicReadPlanRanges<mask, gap, TicIndexList<I...>>
+{
+  static constexpr TicReadRange ranges[sizeof...(I)] = {
+    TicReadPlanner::range(mask, gap, I)...
+  };
+};
+
+template <TicVariableMask mask, uint8_t gap, uint8_t... I>
+constexpr TicReadRange
+  TicReadPlanRanges<mask, gap, TicIndexList<I...>>::ranges[sizeof...(I)];
+
+/// \endcond
+
+/// This class template holds a read plan computed at compile time for a
+/// constant ::TicVariableMask.  It is used by the templated version of
+/// TicBase::getVariables().
+template <TicVariableMask mask, uint8_t gap>
+struct TicReadPlan : TicReadPlanRanges<mask, gap,
+  typename TicMakeIndexList<TicReadPlanner::count(mask, gap)>::type>
+{
+  static_assert(mask != 0, "The variable mask must not be empty.");
+
+  /// The number of reads in the plan.
+  static constexpr uint8_t count = TicReadPlanner::count(mask, gap);
+};
+
+/// This class template is a Tic whose transport is chosen at compile time, so
+/// the most frequent commands can be encoded right where they are called
+/// instead of going through a virtual function.  TicSerial and TicI2C are
+/// derived from it, using TicSerialTransport and TicI2CTransport.
 ///
-/// For the high-level commands you can use on this object, see TicBase.
-class TicI2C : public TicBase
+/// The following functions are redefined here so that calling them on a TicT
+/// object (or a TicSerial or TicI2C object) does not make a virtual call:
+/// setTargetPosition(), setTargetVelocity(), haltAndSetPosition(),
+/// haltAndHold(), and resetCommandTimeout().  They behave the same as the
+/// TicBase versions, and they fall back to those if a TicCommandShadow is
+/// attached.  Calls through a TicBase pointer or reference still work as
+/// before.
+///
+/// A transport is a class with these public functions, which return an
+/// error code like TicBase::getLastError():
+///
+/// - `uint8_t commandQuick(TicCommand cmd)`
+/// - `uint8_t commandW32(TicCommand cmd, uint32_t val)`
+/// - `uint8_t commandW7(TicCommand cmd, uint8_t val)`
+/// - `uint8_t getSegment(TicCommand cmd, uint8_t offset, uint8_t length,
+///   void * buffer)`, which must zero the buffer if it fails
+///
+/// and `uint8_t maxSegmentLength()`, which returns the longest read it can do.
+/// For TicStats, it also needs `uint8_t bytesSent(TicCommand cmd)` and
+/// `uint8_t bytesReceived(uint8_t length)`, which return the number of bytes
+/// that a command (or read request) and a read response take on the bus.
+template <class Transport>
+class TicT : public TicBase
 {
 public:
-  /// Creates a new TicI2C object that will use the `Wire` object to communicate
-  /// with the Tic over I2C.
-  ///
-  /// The optional `address` parameter specifies the 7-bit I2C address to use,
-  /// and it must match the Tic's "Device number" setting.  It defaults to 14.
-  ///
-  /// The optional `bus` parameter specifies the I2C bus to use.  You can also
-  /// set the bus with setBus().
-  TicI2C(uint8_t address = 14, TwoWire * bus = &Wire)
-    : _address(address), _bus(bus)
+  /// Creates a Tic that uses a copy of the specified transport.
+  TicT(const Transport & transport) : _transport(transport)
   {
   }
 
-  /// Configures this object to use the specified I2C bus.
-  /// The default bus is Wire, which is typically the first or only I2C bus on
-  /// an Arduino.  To use Wire1 instead, you can write:
-  /// ```{.cpp}
-  /// tic.setBus(&Wire1);
-  /// ```
-  /// \param bus A pointer to a TwoWire object representing the I2C bus to use.
-  void setBus(TwoWire * bus)
+  /// See TicBase::setTargetPosition().
+  void setTargetPosition(int32_t position)
   {
-    this->_bus = bus;
+    streamW32(TicCommand::SetTargetPosition, position);
   }
 
-  /// Returns a pointer to the I2C bus that this object is configured to
-  /// use.
-  TwoWire * getBus()
+  /// See TicBase::setTargetVelocity().
+  void setTargetVelocity(int32_t velocity)
   {
-    return _bus;
+    streamW32(TicCommand::SetTargetVelocity, velocity);
   }
 
-  /// Configures this object to use the specified 7-bit I2C address.
-  /// This must match the address that the Motoron is configured to use.
-  void setAddress(uint8_t address)
+  /// See TicBase::haltAndSetPosition().
+  void haltAndSetPosition(int32_t position)
   {
-    this->_address = address;
+    streamW32(TicCommand::HaltAndSetPosition, position);
   }
 
-  /// Returns the 7-bit I2C address that this object is configured to use.
-  uint8_t getAddress()
+  /// See TicBase::haltAndHold().
+  void haltAndHold()
+  {
+    streamQuick(TicCommand::HaltAndHold);
+  }
+
+  /// See TicBase::resetCommandTimeout().
+  void resetCommandTimeout()
   {
-    return _address;
+    streamQuick(TicCommand::ResetCommandTimeout);
   }
 
+protected:
+  Transport _transport;
+
 private:
-  uint8_t _address;
-  TwoWire * _bus;
+  void streamQuick(TicCommand cmd)
+  {
+    if (getCommandShadow()) { sendQuick(cmd); return; }
+    TicT::commandQuick(cmd);
+  }
+
+  void streamW32(TicCommand cmd, uint32_t val)
+  {
+    if (getCommandShadow()) { sendW32(cmd, val); return; }
+    TicT::commandW32(cmd, val);
+  }
+
+  void commandQuick(TicCommand cmd)
+  {
+    uint32_t start = statsStart();
+    _lastError = _transport.commandQuick(cmd);
+    recordCommand();
+    statsRecord(cmd, start, _transport.bytesSent(cmd), 0);
+  }
+
+  void commandW32(TicCommand cmd, uint32_t val)
+  {
+    uint32_t start = statsStart();
+    _lastError = _transport.commandW32(cmd, val);
+    recordCommand();
+    statsRecord(cmd, start, _transport.bytesSent(cmd), 0);
+  }
+
+  void commandW7(TicCommand cmd, uint8_t val)
+  {
+    uint32_t start = statsStart();
+    _lastError = _transport.commandW7(cmd, val);
+    recordCommand();
+    statsRecord(cmd, start, _transport.bytesSent(cmd), 0);
+  }
 
-  void commandQuick(TicCommand cmd);
-  void commandW32(TicCommand cmd, uint32_t val);
-  void commandW7(TicCommand cmd, uint8_t val);
   void getSegment(TicCommand cmd, uint8_t offset,
-    uint8_t length, void * buffer);
-  void delayAfterRead();
+    uint8_t length, void * buffer)
+  {
+    uint32_t start = statsStart();
+    _lastError = _transport.getSegment(cmd, offset, length, buffer);
+    statsRecord(cmd, start, _transport.bytesSent(cmd),
+      _transport.bytesReceived(length));
+  }
+
+  uint8_t maxSegmentLength()
+  {
+    return _transport.maxSegmentLength();
+  }
+};
+
+/// The maximum number of bytes in a serial command: the Pololu protocol
+/// header, four data bytes, a byte with their most-significant bits, and a
+/// CRC byte.
+const uint8_t TicMaxFrameLength = 9;
+
+/// This struct holds the bytes of one serial command, ready to be sent with
+/// TicSerial::sendFrame().  See TicFrameBuilder.
+struct TicFrame
+{
+  uint8_t length;
+  uint8_t data[TicMaxFrameLength];
+};
+
+/// This class encodes serial commands at compile time.  Its functions are
+/// constexpr, so for constant arguments the whole frame, including the
+/// Pololu protocol header and CRC byte, is computed by the compiler and can
+/// be stored in flash.
+///
+/// Example usage:
+/// ```
+/// // Device number 14, CRC for commands disabled.
+/// const TicFrame microstep8 PROGMEM = TicFrameBuilder::w7(
+///   TicCommand::SetStepMode, (uint8_t)TicStepMode::Microstep8, 14);
+/// const TicFrame halt PROGMEM =
+///   TicFrameBuilder::quick(TicCommand::HaltAndHold, 14);
+///
+/// void loop()
+/// {
+///   tic.sendFrame_P(&microstep8);
+///   tic.sendFrame_P(&halt);
+/// }
+/// ```
+///
+/// The `deviceNumber` and `crc` arguments must match the TicSerial object
+/// used to send the frame: 255 means the compact protocol, and `crc` should
+/// match TicSerial::getCrcForCommands().
+class TicFrameBuilder
+{
+public:
+  /// Encodes a command with no data, like TicCommand::HaltAndHold.
+  static constexpr TicFrame quick(TicCommand cmd, uint8_t deviceNumber = 255,
+    bool crc = false)
+  {
+    return make(cmd, 0, 0, deviceNumber, crc);
+  }
+
+  /// Encodes a command with one 7-bit data byte, like TicCommand::SetStepMode.
+  static constexpr TicFrame w7(TicCommand cmd, uint8_t val,
+    uint8_t deviceNumber = 255, bool crc = false)
+  {
+    return make(cmd, val, 1, deviceNumber, crc);
+  }
+
+  /// Encodes a command with 32 bits of data, like
+  /// TicCommand::SetTargetVelocity.
+  static constexpr TicFrame w32(TicCommand cmd, uint32_t val,
+    uint8_t deviceNumber = 255, bool crc = false)
+  {
+    return make(cmd, val, 5, deviceNumber, crc);
+  }
+
+private:
+  static constexpr uint8_t headerLength(uint8_t deviceNumber)
+  {
+    return deviceNumber == 255 ? 1 : 3;
+  }
+
+  static constexpr uint8_t headerByte(TicCommand cmd, uint8_t deviceNumber,
+    uint8_t i)
+  {
+    return deviceNumber == 255 ? (uint8_t)cmd :
+      i == 0 ? 0xAA :
+      i == 1 ? (deviceNumber & 0x7F) :
+      ((uint8_t)cmd & 0x7F);
+  }
+
+  // The data bytes are laid out as in TicSerialTransport::commandW32() and
+  // TicSerialTransport::commandW7().
+  static constexpr uint8_t dataByte(uint32_t val, uint8_t dataLength,
+    uint8_t i)
+  {
+    return dataLength == 1 ? (val & 0x7F) :
+      i == 0 ? (((val >>  7) & 1) | ((val >> 14) & 2) |
+                ((val >> 21) & 4) | ((val >> 28) & 8)) :
+      (val >> (8 * (i - 1)) & 0x7F);
+  }
+
+  // Returns byte `i` of the frame without the CRC.
+  static constexpr uint8_t messageByte(TicCommand cmd, uint32_t val,
+    uint8_t dataLength, uint8_t deviceNumber, uint8_t i)
+  {
+    return i < headerLength(deviceNumber) ?
+      headerByte(cmd, deviceNumber, i) :
+      dataByte(val, dataLength, i - headerLength(deviceNumber));
+  }
+
+  // Processes the 8 bits of one byte for the CRC-7 used by the Pololu serial
+  // protocols (polynomial 0x91, least-significant bit first).
+  static constexpr uint8_t crcBits(uint8_t crc, uint8_t bits)
+  {
+    return bits == 0 ? crc :
+      crcBits((crc & 1) ? (crc ^ 0x91) >> 1 : crc >> 1, bits - 1);
+  }
+
+  static constexpr uint8_t crcFrom(TicCommand cmd, uint32_t val,
+    uint8_t dataLength, uint8_t deviceNumber, uint8_t i, uint8_t crc)
+  {
+    return i == headerLength(deviceNumber) + dataLength ? crc :
+      crcFrom(cmd, val, dataLength, deviceNumber, i + 1,
+        crcBits(crc ^ messageByte(cmd, val, dataLength, deviceNumber, i), 8));
+  }
+
+  // Returns byte `i` of the frame, including the CRC if there is one, or 0
+  // if `i` is past the end.
+  static constexpr uint8_t frameByte(TicCommand cmd, uint32_t val,
+    uint8_t dataLength, uint8_t deviceNumber, bool crc, uint8_t i)
+  {
+    return i < headerLength(deviceNumber) + dataLength ?
+        messageByte(cmd, val, dataLength, deviceNumber, i) :
+      crc && i == headerLength(deviceNumber) + dataLength ?
+        crcFrom(cmd, val, dataLength, deviceNumber, 0, 0) :
+      0;
+  }
+
+  static constexpr TicFrame make(TicCommand cmd, uint32_t val,
+    uint8_t dataLength, uint8_t deviceNumber, bool crc)
+  {
+    return TicFrame {
+      (uint8_t)(headerLength(deviceNumber) + dataLength + crc),
+      {
+        frameByte(cmd, val, dataLength, deviceNumber, crc, 0),
+        frameByte(cmd, val, dataLength, deviceNumber, crc, 1),
+        frameByte(cmd, val, dataLength, deviceNumber, crc, 2),
+        frameByte(cmd, val, dataLength, deviceNumber, crc, 3),
+        frameByte(cmd, val, dataLength, deviceNumber, crc, 4),
+        frameByte(cmd, val, dataLength, deviceNumber, crc, 5),
+        frameByte(cmd, val, dataLength, deviceNumber, crc, 6),
+        frameByte(cmd, val, dataLength, deviceNumber, crc, 7),
+        frameByte(cmd, val, dataLength, deviceNumber, crc, 8),
+      }
+    };
+  }
+};
+
+/// The transport used by TicSerial.  It sends commands using the compact
+/// protocol, or the Pololu protocol if a device number is given, and
+/// optionally adds CRC bytes.  See TicT.
+///
+/// Example usage:
+/// ```
+/// TicT<TicSerialTransport> tic(TicSerialTransport(ticSerial, 14));
+/// ```
+///
+/// Most programs should use TicSerial, which adds retries and non-blocking
+/// reads.
+class TicSerialTransport
+{
+public:
+  /// Creates a transport for the specified serial port.  See
+  /// TicSerial::TicSerial().
+  TicSerialTransport(Stream & stream, uint8_t deviceNumber = 255)
+    : _stream(&stream), _deviceNumber(deviceNumber)
+  {
+  }
+
+  uint8_t commandQuick(TicCommand cmd)
+  {
+    uint8_t frame[maxFrameLength];
+    sendFrame(frame, writeHeader(frame, cmd));
+    return 0;
+  }
+
+  uint8_t commandW32(TicCommand cmd, uint32_t val)
+  {
+    uint8_t frame[maxFrameLength];
+    uint8_t length = writeHeader(frame, cmd);
+
+    // byte with MSbs:
+    // bit 0 = MSb of first (least significant) data byte
+    // bit 1 = MSb of second data byte
+    // bit 2 = MSb of third data byte
+    // bit 3 = MSb of fourth (most significant) data byte
+    frame[length++] = ((val >>  7) & 1) |
+                      ((val >> 14) & 2) |
+                      ((val >> 21) & 4) |
+                      ((val >> 28) & 8);
+
+    // data bytes, least significant first, with MSbs cleared
+    frame[length++] = (val >> 0) & 0x7F;
+    frame[length++] = (val >> 8) & 0x7F;
+    frame[length++] = (val >> 16) & 0x7F;
+    frame[length++] = (val >> 24) & 0x7F;
+
+    sendFrame(frame, length);
+    return 0;
+  }
+
+  uint8_t commandW7(TicCommand cmd, uint8_t val)
+  {
+    uint8_t frame[maxFrameLength];
+    uint8_t length = writeHeader(frame, cmd);
+    frame[length++] = val & 0x7F;
+    sendFrame(frame, length);
+    return 0;
+  }
+
+  uint8_t getSegment(TicCommand cmd, uint8_t offset,
+    uint8_t length, void * buffer);
+
+  uint8_t maxSegmentLength() { return TicMaxSegmentLength; }
+
+  uint8_t bytesSent(TicCommand cmd)
+  {
+    uint8_t length = (_deviceNumber == 255 ? 1 : 3) + _crcForCommands;
+    switch ((uint8_t)cmd >> 4)
+    {
+    case 0xE: return length + 5;
+    case 0xA: return length + 2;
+    case 0x9: return length + 1;
+    default: return length;
+    }
+  }
+
+  uint8_t bytesReceived(uint8_t length)
+  {
+    return length + _crcForResponses;
+  }
+
+private:
+  Stream * _stream;
+  uint8_t _deviceNumber;
+  bool _crcForCommands = false;
+  bool _crcForResponses = false;
+
+  static const uint8_t maxFrameLength = TicMaxFrameLength;
+
+  uint8_t writeHeader(uint8_t * frame, TicCommand cmd)
+  {
+    if (_deviceNumber == 255)
+    {
+      // Compact protocol
+      frame[0] = (uint8_t)cmd;
+      return 1;
+    }
+    else
+    {
+      // Pololu protocol
+      frame[0] = 0xAA;
+      frame[1] = _deviceNumber & 0x7F;
+      frame[2] = (uint8_t)cmd & 0x7F;
+      return 3;
+    }
+  }
+
+  // Sends a frame with a single write so that it goes out in one piece, which
+  // is much faster than writing it one byte at a time on most serial ports.
+  // The frame buffer must have room for the CRC byte.
+  void sendFrame(uint8_t * frame, uint8_t length)
+  {
+    if (_crcForCommands)
+    {
+      frame[length] = crc7(frame, length);
+      length++;
+    }
+    _stream->write(frame, length);
+  }
+
+  void sendSegmentRequest(TicCommand cmd, uint8_t offset, uint8_t length);
+  static uint8_t crc7(const uint8_t * message, uint8_t length);
+
+  friend class TicSerial;
+};
+
+/// This struct holds one pending non-blocking read for TicSerial.  You should
+/// not need to use its members; just provide an array of them to
+/// TicSerial::setRequestQueue().
+struct TicSerialRequest
+{
+  uint8_t * buffer;
+  uint8_t length;
+};
+
+/// Represents a serial connection to a Tic.
+///
+/// For the high-level commands you can use on this object, see TicBase.
+class TicSerial : public TicT<TicSerialTransport>
+{
+public:
+  /// Creates a new TicSerial object.
+  ///
+  /// The `stream` argument should be a hardware or software serial object.
+  /// This class will store a pointer to it and use it to communicate with the
+  /// Tic.  You should initialize it and set it to use the correct baud rate
+  /// before sending commands with this class.
+  ///
+  /// The `deviceNumber` argument is optional.  If it is omitted or 255, the
+  /// TicSerial object will use the compact protocol.  If it is a number between
+  /// 0 and 127, it specifies the device number to use in Pololu protocol,
+  /// allowing you to control multiple Tic controllers on a single serial bus.
+  ///
+  /// For example, to use the first open hardware serial port to send compact
+  /// protocol commands to one Tic, write this at the top of your sketch:
+  /// ```
+  /// TicSerial tic(SERIAL_PORT_HARDWARE_OPEN);
+  /// ```
+  ///
+  /// For example, to use a SoftwareSerial port and send Pololu protocol
+  /// commands to two different Tic controllers, write this at the top of your sketch:
+  ///
+  /// ```
+  /// #include <SoftwareSerial.h>
+  /// SoftwareSerial ticSerial(10, 11);
+  /// TicSerial tic1(ticSerial, 14);
+  /// TicSerial tic2(ticSerial, 15);
+  /// ```
+  TicSerial(Stream & stream, uint8_t deviceNumber = 255) :
+    TicT(TicSerialTransport(stream, deviceNumber))
+  {
+  }
+
+  /// Gets the serial device number specified in the constructor.
+  uint8_t getDeviceNumber() { return _transport._deviceNumber; }
+
+  /// Sends a command that was encoded ahead of time with TicFrameBuilder.
+  ///
+  /// The frame is sent as-is, so it must have been built with this object's
+  /// device number and CRC setting.  It does not go through the
+  /// TicCommandShadow, so if there is one, this function clears it.
+  void sendFrame(const TicFrame & frame)
+  {
+    uint32_t start = statsStart();
+    _transport._stream->write(frame.data, frame.length);
+    _lastError = 0;
+    recordCommand();
+    statsRecord((TicCommand)(frame.data[frame.data[0] == 0xAA ? 2 : 0] | 0x80),
+      start, frame.length, 0);
+    if (getCommandShadow()) { getCommandShadow()->invalidate(); }
+  }
+
+  /// Same as sendFrame(), except the frame is read from flash (PROGMEM).
+  void sendFrame_P(const TicFrame * frame)
+  {
+    TicFrame copy;
+    memcpy_P(&copy, frame, sizeof(TicFrame));
+    sendFrame(copy);
+  }
+
+  /// Starts reading a block of variables from the Tic without waiting for the
+  /// response.  The length must be at most ::TicMaxSegmentLength.
+  ///
+  /// This function sends the request and returns right away.  The response is
+  /// stored in `buffer` as it arrives while you call poll(), so the buffer
+  /// must stay valid until poll() returns true.
+  ///
+  /// Example usage:
+  /// ```
+  /// uint8_t position[4];
+  /// tic.beginGetVariable(0x22, 4, position);  // Current position
+  ///
+  /// // Later, in loop():
+  /// if (tic.poll() && tic.getLastError() == 0)
+  /// {
+  ///   // position now holds the current position.
+  /// }
+  /// ```
+  ///
+  /// By default, only one request can be pending at a time, so if another
+  /// request is still pending, this function first waits for it to finish.
+  /// To send several requests back-to-back, see setRequestQueue().
+  void beginGetVariable(uint8_t offset, uint8_t length, void * buffer)
+  {
+    beginGetSegment(TicCommand::GetVariable, offset, length, buffer);
+  }
+
+  /// Starts reading a block of settings from the Tic without waiting for the
+  /// response.  This works like beginGetVariable().
+  void beginGetSetting(uint8_t offset, uint8_t length, void * buffer)
+  {
+    beginGetSegment(TicCommand::GetSetting, offset, length, buffer);
+  }
+
+  /// Processes any response bytes that have arrived for requests started with
+  /// beginGetVariable() or beginGetSetting().
+  ///
+  /// Returns true if no request is pending anymore, either because all of the
+  /// responses were received or because a request timed out.  When the
+  /// requests finish, getLastError() returns 0 if they succeeded, 50 if one
+  /// timed out, or 51 if a response had the wrong CRC (see
+  /// setCrcForResponses()).  A timeout fails that request and all of the
+  /// requests after it, since their responses can no longer be told apart,
+  /// and fills their buffers with zeros.  If no request was pending, this
+  /// function returns true without changing getLastError().
+  ///
+  /// This function never blocks, so you can call it from your main loop
+  /// while doing other things.
+  bool poll();
+
+  /// Returns true if a request started with beginGetVariable() or
+  /// beginGetSetting() has not finished yet.
+  bool isRequestPending() { return _requestCount != 0; }
+
+  /// Returns the number of requests that have not finished yet.
+  uint8_t getPendingRequestCount() { return _requestCount; }
+
+  /// Lets this object have several non-blocking requests pending at once.
+  ///
+  /// The Tic answers serial requests in the order it receives them, so
+  /// requests can be sent back-to-back without waiting for each response.
+  /// On a full-duplex serial port this hides most of the time spent waiting
+  /// for the Tic to respond.
+  ///
+  /// Example usage:
+  /// ```
+  /// TicSerialRequest ticQueue[4];
+  ///
+  /// void setup()
+  /// {
+  ///   tic.setRequestQueue(ticQueue, 4);
+  /// }
+  ///
+  /// void loop()
+  /// {
+  ///   uint8_t position[4], velocity[4], flags[1];
+  ///   tic.beginGetVariable(0x22, 4, position);  // Current position
+  ///   tic.beginGetVariable(0x26, 4, velocity);  // Current velocity
+  ///   tic.beginGetVariable(0x01, 1, flags);     // Misc flags 1
+  ///   while (!tic.poll()) {}
+  /// }
+  /// ```
+  ///
+  /// The responses are stored in FIFO order, so only one TicSerial object on
+  /// a serial bus should have requests pending at a time.  Any pending
+  /// requests must finish before you call this function.  Passing `nullptr`
+  /// goes back to allowing only one pending request.
+  void setRequestQueue(TicSerialRequest * queue, uint8_t size)
+  {
+    finishRequest();
+    if (queue == nullptr || size == 0)
+    {
+      queue = &_defaultRequest;
+      size = 1;
+    }
+    _requestQueue = queue;
+    _requestQueueSize = size;
+  }
+
+  /// Sets how long poll() waits for the response to a request before giving
+  /// up, in milliseconds.  The default is 100 ms.
+  ///
+  /// The blocking functions such as TicBase::getCurrentPosition() use the
+  /// stream's timeout instead, which you can set with `Stream::setTimeout()`.
+  void setRequestTimeout(uint16_t timeout) { _requestTimeout = timeout; }
+
+  /// Gets the timeout set with setRequestTimeout().
+  uint16_t getRequestTimeout() { return _requestTimeout; }
+
+  /// Enables or disables the 7-bit CRC byte at the end of each command.
+  ///
+  /// This should match the Tic's "Enable CRC for commands" setting.  With CRC
+  /// enabled, the Tic ignores any command that was corrupted on the way, so
+  /// a flipped bit cannot change a target or speed.  The Tic does not
+  /// acknowledge commands, though, so you should check the
+  /// TicError::SerialError bit from TicBase::getErrorStatus() or
+  /// TicBase::getErrorsOccurred() to find out about rejected commands.
+  void setCrcForCommands(bool enable)
+  {
+    _transport._crcForCommands = enable;
+  }
+
+  /// Returns true if CRC is enabled for commands.
+  bool getCrcForCommands() { return _transport._crcForCommands; }
+
+  /// Enables or disables checking of the 7-bit CRC byte at the end of each
+  /// response from the Tic.
+  ///
+  /// This should match the Tic's "Enable CRC for responses" setting.  When a
+  /// response has the wrong CRC, getLastError() returns 51.
+  void setCrcForResponses(bool enable)
+  {
+    _transport._crcForResponses = enable;
+  }
+
+  /// Returns true if CRC is enabled for responses.
+  bool getCrcForResponses() { return _transport._crcForResponses; }
+
+  /// Sets how many times a blocking read is sent again if its response is
+  /// corrupted or does not arrive.  The default is 0.
+  ///
+  /// Retrying is safe because reads do not change anything on the Tic (except
+  /// TicBase::getErrorsOccurred(), which could lose some error bits).
+  /// Commands are never retried since the Tic does not respond to them.
+  void setRetryLimit(uint8_t retries) { _retryLimit = retries; }
+
+  /// Gets the retry limit set with setRetryLimit().
+  uint8_t getRetryLimit() { return _retryLimit; }
+
+private:
+  TicSerialRequest _defaultRequest;
+  TicSerialRequest * _requestQueue = &_defaultRequest;
+  uint8_t _requestQueueSize = 1;
+  uint8_t _requestHead = 0;
+  uint8_t _requestCount = 0;
+  uint8_t _requestReceived = 0;
+  uint16_t _requestStartTime = 0;
+  uint16_t _requestTimeout = 100;
+  uint8_t _requestError = 0;
+
+  uint8_t _retryLimit = 0;
+
+  void beginGetSegment(TicCommand cmd, uint8_t offset,
+    uint8_t length, void * buffer);
+  void finishRequest() { while (!poll()) {} }
+
+  uint8_t commandR8(TicCommand cmd);
+  void getSegment(TicCommand cmd, uint8_t offset,
+    uint8_t length, void * buffer);
+
+  void setDeviceNumber(uint8_t deviceNumber)
+  {
+    _transport._deviceNumber = deviceNumber;
+  }
+
+  friend class TicSerialBus;
+};
+
+/// This class collects the bytes written to a serial port and sends them all
+/// at once, so that commands for several Tics can go out together.
+///
+/// TicSerial already sends each command with a single write, but every write
+/// still has some overhead, which is significant on USB virtual serial ports
+/// (one USB packet each) and on SoftwareSerial.  With a TicSerialBatch, a
+/// whole set of commands becomes one write.
+///
+/// To use it, create a TicSerialBatch for your serial port, create your
+/// TicSerial objects using the TicSerialBatch instead of the port, and call
+/// flush() when you want the commands to be sent:
+///
+/// ```
+/// uint8_t batchBuffer[64];
+/// TicSerialBatch ticBatch(ticSerial, batchBuffer, sizeof(batchBuffer));
+/// TicSerial tic1(ticBatch, 14);
+/// TicSerial tic2(ticBatch, 15);
+///
+/// void loop()
+/// {
+///   tic1.setTargetVelocity(2000000);
+///   tic2.setTargetVelocity(-2000000);
+///   ticBatch.flush();  // Send both commands.
+/// }
+/// ```
+///
+/// If the buffer fills up, the buffered bytes are sent early.  Any read from
+/// the Tic also sends the buffered bytes first, so that the read request is
+/// not left waiting in the buffer.
+///
+/// Reads through a TicSerialBatch wait for the response using the batch's
+/// timeout, not the port's.  The batch starts with the port's timeout, and
+/// setTimeout() on the batch sets both, but if you change the port's timeout
+/// later, set it on the batch instead.
+class TicSerialBatch : public Stream
+{
+public:
+  /// Creates a new TicSerialBatch that writes to the specified stream and
+  /// uses the specified buffer to hold up to `size` bytes.
+  TicSerialBatch(Stream & stream, uint8_t * buffer, uint8_t size)
+    : _stream(&stream), _buffer(buffer), _size(size)
+  {
+    Stream::setTimeout(stream.getTimeout());
+  }
+
+  /// Sets the time in milliseconds to wait for each byte of a response, for
+  /// both the batch and the underlying stream.
+  void setTimeout(unsigned long timeout)
+  {
+    Stream::setTimeout(timeout);
+    _stream->setTimeout(timeout);
+  }
+
+  /// Adds a byte to the batch.
+  size_t write(uint8_t byte) override;
+
+  /// Adds bytes to the batch.
+  size_t write(const uint8_t * data, size_t length) override;
+
+  /// Sends all of the bytes in the batch with a single write.
+  ///
+  /// Unlike the `flush()` function of a hardware serial port, this does not
+  /// wait for the bytes to be transmitted.
+  void flush() override;
+
+  /// Returns the number of bytes waiting to be sent.
+  uint8_t getLength() { return _length; }
+
+  /// Sends any buffered bytes and then returns the number of bytes available
+  /// to read from the underlying stream.
+  int available() override { flush(); return _stream->available(); }
+
+  /// Sends any buffered bytes and then reads a byte from the underlying
+  /// stream.
+  int read() override { flush(); return _stream->read(); }
+
+  /// Sends any buffered bytes and then peeks at the next byte from the
+  /// underlying stream.
+  int peek() override { flush(); return _stream->peek(); }
+
+private:
+  Stream * const _stream;
+  uint8_t * const _buffer;
+  const uint8_t _size;
+  uint8_t _length = 0;
+};
+
+/// This class sends commands to a group of Tics that share a serial bus.
+///
+/// Commands that have no device-specific data, such as haltAndHold() and
+/// resetCommandTimeout(), are sent once using the compact protocol.  Every
+/// Tic on the bus obeys compact protocol commands regardless of its device
+/// number, so a single frame reaches the whole group.  This is the fastest way
+/// to stop many motors at once.
+///
+/// Example usage:
+/// ```
+/// TicSerial tic1(ticSerial, 14);
+/// TicSerial tic2(ticSerial, 15);
+/// TicSerial * const tics[] = { &tic1, &tic2 };
+/// TicSerialGroup allTics(ticSerial, tics, 2);
+///
+/// void loop()
+/// {
+///   if (emergencyStop)
+///   {
+///     allTics.haltAndHold();  // one frame for every Tic
+///   }
+/// }
+/// ```
+///
+/// A compact protocol command is also obeyed by any Tic on the bus that is
+/// not in the group, and it could be misinterpreted by other kinds of devices
+/// on the bus.  If that is a problem, call setBroadcast(false) and the group
+/// will send a separate Pololu protocol frame to each member instead.
+class TicSerialGroup
+{
+public:
+  /// Creates a new group.  The `members` array must contain `count` pointers
+  /// to TicSerial objects that use `stream`, and it must stay valid as long as
+  /// the group is used.
+  TicSerialGroup(Stream & stream, TicSerial * const * members, uint8_t count)
+    : _all(stream), _members(members), _count(count)
+  {
+  }
+
+  /// Chooses whether to send commands once for the whole group (the default)
+  /// or separately to each member.
+  void setBroadcast(bool broadcast) { _broadcast = broadcast; }
+
+  /// Returns true if commands are sent once for the whole group.
+  bool getBroadcast() { return _broadcast; }
+
+  /// Enables or disables the CRC byte on broadcast commands.  This must be
+  /// enabled if the Tics require CRC for commands.  See
+  /// TicSerial::setCrcForCommands().
+  void setCrcForCommands(bool enable) { _all.setCrcForCommands(enable); }
+
+  /// Sends the "Halt and hold" command to every Tic in the group.  See
+  /// TicBase::haltAndHold().
+  void haltAndHold() { send(&TicBase::haltAndHold); }
+
+  /// Sends the "Reset command timeout" command to every Tic in the group.
+  /// See TicBase::resetCommandTimeout().
+  void resetCommandTimeout() { send(&TicBase::resetCommandTimeout); }
+
+  /// Sends the De-energize command to every Tic in the group.  See
+  /// TicBase::deenergize().
+  void deenergize() { send(&TicBase::deenergize); }
+
+  /// Sends the Energize command to every Tic in the group.  See
+  /// TicBase::energize().
+  void energize() { send(&TicBase::energize); }
+
+  /// Sends the "Exit safe start" command to every Tic in the group.  See
+  /// TicBase::exitSafeStart().
+  void exitSafeStart() { send(&TicBase::exitSafeStart); }
+
+  /// Sends the "Enter safe start" command to every Tic in the group.  See
+  /// TicBase::enterSafeStart().
+  void enterSafeStart() { send(&TicBase::enterSafeStart); }
+
+  /// Returns the number of members in the group.
+  uint8_t getCount() { return _count; }
+
+  /// Returns a pointer to the member with the specified index, which you can
+  /// use to send commands with device-specific data.
+  TicSerial * getMember(uint8_t index) { return _members[index]; }
+
+private:
+  void send(void (TicBase::*command)())
+  {
+    if (_broadcast)
+    {
+      (_all.*command)();
+
+      // The members did not see the command go out, so record it for
+      // TicKeepalive, and make sure their shadows do not keep targets the
+      // command may have cleared.
+      for (uint8_t i = 0; i < _count; i++)
+      {
+        if (_all.getLastError() == 0)
+        {
+          _members[i]->_lastCommandTime = _all.getLastCommandTime();
+        }
+        if (command != &TicBase::resetCommandTimeout)
+        {
+          TicCommandShadow * shadow = _members[i]->getCommandShadow();
+          if (shadow) { shadow->invalidateTargets(); }
+        }
+      }
+    }
+    else
+    {
+      for (uint8_t i = 0; i < _count; i++)
+      {
+        (_members[i]->*command)();
+      }
+    }
+  }
+
+  TicSerial _all;
+  TicSerial * const * const _members;
+  const uint8_t _count;
+  bool _broadcast = true;
+};
+
+/// Flag in a trace record's header byte: the bytes were received from a Tic
+/// rather than sent to it.  See TicTraceBuffer.
+const uint8_t TicTraceReceived = 0x80;
+
+/// Flag in a trace record's header byte: the bytes were transferred over
+/// I2C, and the first data byte is the 7-bit I2C address.
+const uint8_t TicTraceI2C = 0x40;
+
+/// The maximum number of data bytes in one trace record.
+const uint8_t TicTraceMaxData = 0x3F;
+
+/// This class records the bytes exchanged with Tics, with timestamps, in a
+/// ring buffer that you provide.  When the buffer is full, the oldest records
+/// are dropped.  You can send the contents to a computer with dump() and
+/// replay them with the tic_trace_replay program in extras/host.
+///
+/// To record serial traffic, pass a TicTraceStream to TicSerial instead of
+/// the serial port.  To record I2C traffic, call TicI2C::setTrace().
+///
+/// Example usage:
+/// ```
+/// uint8_t traceData[1024];
+/// TicTraceBuffer trace(traceData, sizeof(traceData));
+/// TicTraceStream tracedSerial(ticSerial, trace);
+/// TicSerial tic(tracedSerial);
+///
+/// // When something goes wrong:
+/// trace.dump(Serial);
+/// ```
+///
+/// Each record is a header byte, the time since the previous record, and up
+/// to ::TicTraceMaxData data bytes.  The header byte holds the
+/// ::TicTraceReceived and ::TicTraceI2C flags and, in its lower 6 bits, the
+/// number of data bytes.  The time is in the units of the clock (microseconds
+/// by default) and is stored 7 bits per byte, least significant first, with
+/// the most significant bit of each byte set if another byte follows.
+/// Consecutive bytes that are read from a serial port go in one record with
+/// the time of the first byte.
+class TicTraceBuffer
+{
+public:
+  /// The type of a function that returns the current time, like `micros()`.
+  typedef unsigned long (*Clock)();
+
+  /// Creates a new trace buffer that uses the specified memory.  The
+  /// `clock` argument is the function used to timestamp records.
+  TicTraceBuffer(uint8_t * buffer, uint16_t size, Clock clock = micros)
+    : _buffer(buffer), _size(size), _clock(clock)
+  {
+    clear();
+  }
+
+  /// Adds a record with the specified flags and data.  Data longer than
+  /// ::TicTraceMaxData is split into several records.
+  void record(uint8_t flags, const uint8_t * data, uint8_t length);
+
+  /// Adds a byte to the last record if it was started by append() with the
+  /// same flags and has room, or starts a new record.
+  void append(uint8_t flags, uint8_t byte);
+
+  /// Removes all records.
+  void clear();
+
+  /// Returns the number of bytes of records in the buffer.
+  uint16_t getLength() { return _used; }
+
+  /// Returns the number of records that were dropped to make room for newer
+  /// ones (or because they did not fit at all).
+  uint32_t getDropped() { return _dropped; }
+
+  /// Writes the records, oldest first, to the specified stream.  They are
+  /// preceded by the five bytes "TicT" and 1 (the format version).  The
+  /// time of the first record is relative to a record that was dropped or to
+  /// the last call to clear(), so it can usually be ignored.
+  void dump(Print & out);
+
+private:
+  static const uint16_t none = 0xFFFF;
+
+  bool startRecord(uint8_t flags, uint8_t length);
+  bool makeRoom(uint16_t length);
+  void put(uint8_t byte);
+  uint8_t at(uint16_t index) { return _buffer[index % _size]; }
+
+  uint8_t * const _buffer;
+  const uint16_t _size;
+  const Clock _clock;
+  uint16_t _head;
+  uint16_t _used;
+  uint16_t _open;
+  unsigned long _lastTime;
+  uint32_t _dropped;
+};
+
+/// This class passes everything through to another stream while recording
+/// what is written and read in a TicTraceBuffer.  Each write is recorded as
+/// one record, so frames written by TicSerial stay together.
+class TicTraceStream : public Stream
+{
+public:
+  /// Creates a stream that traces the specified stream.
+  TicTraceStream(Stream & stream, TicTraceBuffer & trace)
+    : _stream(&stream), _trace(&trace)
+  {
+  }
+
+  size_t write(uint8_t byte) override
+  {
+    _trace->record(0, &byte, 1);
+    return _stream->write(byte);
+  }
+
+  size_t write(const uint8_t * data, size_t length) override;
+
+  int available() override { return _stream->available(); }
+
+  int read() override
+  {
+    int byte = _stream->read();
+    if (byte >= 0) { _trace->append(TicTraceReceived, byte); }
+    return byte;
+  }
+
+  int peek() override { return _stream->peek(); }
+
+  void flush() override { _stream->flush(); }
+
+private:
+  Stream * const _stream;
+  TicTraceBuffer * const _trace;
+};
+
+/// The transport used by TicI2C.  See TicT.
+///
+/// Example usage:
+/// ```
+/// TicT<TicI2CTransport> tic(TicI2CTransport(14, &Wire));
+/// ```
+class TicI2CTransport
+{
+public:
+  /// Creates a transport for the Tic with the specified 7-bit I2C address on
+  /// the specified I2C bus.
+  TicI2CTransport(uint8_t address = 14, TwoWire * bus = &Wire)
+    : _address(address), _bus(bus)
+  {
+  }
+
+  uint8_t commandQuick(TicCommand cmd)
+  {
+    _bus->beginTransmission(_address);
+    _bus->write((uint8_t)cmd);
+    if (_trace) { trace(cmd, 0, 0); }
+    return _bus->endTransmission();
+  }
+
+  uint8_t commandW32(TicCommand cmd, uint32_t val)
+  {
+    _bus->beginTransmission(_address);
+    _bus->write((uint8_t)cmd);
+    _bus->write((uint8_t)(val >> 0)); // lowest byte
+    _bus->write((uint8_t)(val >> 8));
+    _bus->write((uint8_t)(val >> 16));
+    _bus->write((uint8_t)(val >> 24)); // highest byte
+    if (_trace) { trace(cmd, val, 4); }
+    return _bus->endTransmission();
+  }
+
+  uint8_t commandW7(TicCommand cmd, uint8_t val)
+  {
+    _bus->beginTransmission(_address);
+    _bus->write((uint8_t)cmd);
+    _bus->write((uint8_t)(val & 0x7F));
+    if (_trace) { trace(cmd, val & 0x7F, 1); }
+    return _bus->endTransmission();
+  }
+
+  uint8_t getSegment(TicCommand cmd, uint8_t offset,
+    uint8_t length, void * buffer);
+
+  uint8_t maxSegmentLength();
+
+  uint8_t bytesSent(TicCommand cmd)
+  {
+    switch ((uint8_t)cmd >> 4)
+    {
+    case 0xE: return 5;
+    case 0xA: case 0x9: return 2;
+    default: return 1;
+    }
+  }
+
+  uint8_t bytesReceived(uint8_t length)
+  {
+    return length;
+  }
+
+private:
+  uint8_t _address;
+  TwoWire * _bus;
+  TicTraceBuffer * _trace = nullptr;
+
+  void trace(TicCommand cmd, uint32_t val, uint8_t dataLength);
+
+  friend class TicI2C;
+};
+
+/// Represents an I2C connection to a Tic.
+///
+/// For the high-level commands you can use on this object, see TicBase.
+class TicI2C : public TicT<TicI2CTransport>
+{
+public:
+  /// Creates a new TicI2C object that will use the `Wire` object to communicate
+  /// with the Tic over I2C.
+  ///
+  /// The optional `address` parameter specifies the 7-bit I2C address to use,
+  /// and it must match the Tic's "Device number" setting.  It defaults to 14.
+  ///
+  /// The optional `bus` parameter specifies the I2C bus to use.  You can also
+  /// set the bus with setBus().
+  TicI2C(uint8_t address = 14, TwoWire * bus = &Wire)
+    : TicT(TicI2CTransport(address, bus))
+  {
+  }
+
+  /// Configures this object to use the specified I2C bus.
+  /// The default bus is Wire, which is typically the first or only I2C bus on
+  /// an Arduino.  To use Wire1 instead, you can write:
+  /// ```{.cpp}
+  /// tic.setBus(&Wire1);
+  /// ```
+  /// \param bus A pointer to a TwoWire object representing the I2C bus to use.
+  void setBus(TwoWire * bus)
+  {
+    _transport._bus = bus;
+  }
+
+  /// Returns a pointer to the I2C bus that this object is configured to
+  /// use.
+  TwoWire * getBus()
+  {
+    return _transport._bus;
+  }
+
+  /// Configures this object to use the specified 7-bit I2C address.
+  /// This must match the address that the Motoron is configured to use.
+  void setAddress(uint8_t address)
+  {
+    _transport._address = address;
+  }
+
+  /// Returns the 7-bit I2C address that this object is configured to use.
+  uint8_t getAddress()
+  {
+    return _transport._address;
+  }
+
+  /// Records the bytes sent to and received from the Tic in the specified
+  /// trace buffer.  Pass `nullptr` to stop.  See TicTraceBuffer.
+  void setTrace(TicTraceBuffer * trace)
+  {
+    _transport._trace = trace;
+  }
+
+  /// Returns the trace buffer specified with setTrace(), or `nullptr`.
+  TicTraceBuffer * getTrace()
+  {
+    return _transport._trace;
+  }
+
+private:
+  void delayAfterRead();
+};
+
+/// A small handle that identifies one Tic on a TicSerialBus or TicI2CBus.
+///
+/// It holds the Tic's serial device number or I2C address, and the type of
+/// Tic (see TicBase::setProduct()), in two bytes.
+struct TicHandle
+{
+  /// Creates a handle for the Tic with the specified serial device number or
+  /// 7-bit I2C address.
+  constexpr TicHandle(uint8_t address,
+    TicProduct product = TicProduct::Unknown)
+    : address(address), product((uint8_t)product)
+  {
+  }
+
+  uint8_t address;
+  uint8_t product;
+};
+
+/// This class represents a serial bus shared by many Tics.  It holds the
+/// transport and the per-bus state once, and you use a TicHandle to pick
+/// which Tic each command goes to, which uses much less RAM per Tic than a
+/// TicSerial object for each one.
+///
+/// Example usage:
+/// ```
+/// TicSerialBus ticBus(Serial1);
+/// const TicHandle tic1(14, TicProduct::T834);
+/// const TicHandle tic2(15, TicProduct::T834);
+///
+/// void loop()
+/// {
+///   ticBus[tic1].setTargetVelocity(2000000);
+///   ticBus[tic2].setTargetVelocity(-2000000);
+///   if (ticBus.getLastError()) { ... }
+/// }
+/// ```
+///
+/// The `[]` operator returns the bus's TicSerial object after pointing it at
+/// the specified Tic, so the full TicBase API is available.  Settings made on
+/// that object, like TicSerial::setCrcForCommands(), apply to every Tic on
+/// the bus.  Pipelined reads started with TicSerial::beginGetVariable() can
+/// only be pending for one Tic at a time, because the responses are matched
+/// to requests in order and responses from different Tics could overlap, so
+/// selecting a different Tic first waits for any pending reads to finish
+/// (see TicSerial::poll()).  Because the object is shared, selecting a Tic
+/// also detaches any TicVariableCache or TicCommandShadow, and it does not
+/// keep a separate TicBase::getLastCommandTime() for each Tic, so use a
+/// TicSerial object for any Tic that needs those.
+class TicSerialBus
+{
+public:
+  /// Creates a bus that uses the specified serial port.
+  TicSerialBus(Stream & stream) : _tic(stream)
+  {
+  }
+
+  /// Points the bus's TicSerial object at the specified Tic and returns it.
+  /// If the object has reads pending for a different Tic, this waits for
+  /// them to finish first.
+  TicSerial & operator[](TicHandle handle)
+  {
+    if (handle.address != _tic.getDeviceNumber() && _tic.isRequestPending())
+    {
+      _tic.finishRequest();
+    }
+    _tic.setDeviceNumber(handle.address);
+    _tic.setProduct((TicProduct)handle.product);
+    _tic.setVariableCache(nullptr);
+    _tic.setCommandShadow(nullptr);
+    return _tic;
+  }
+
+  /// Returns the bus's TicSerial object without changing which Tic it
+  /// talks to.
+  TicSerial & getTic() { return _tic; }
+
+  /// Returns the error from the last communication on this bus.  See
+  /// TicBase::getLastError().
+  uint8_t getLastError() { return _tic.getLastError(); }
+
+private:
+  TicSerial _tic;
+};
+
+/// This class represents an I2C bus shared by many Tics.  It works like
+/// TicSerialBus, except the TicHandle holds an I2C address, and the `[]`
+/// operator returns a TicI2C object.
+///
+/// Example usage:
+/// ```
+/// TicI2CBus ticBus(&Wire);
+/// const TicHandle tic1(14);
+///
+/// void loop()
+/// {
+///   ticBus[tic1].setTargetVelocity(2000000);
+/// }
+/// ```
+class TicI2CBus
+{
+public:
+  /// Creates a bus that uses the specified I2C bus.
+  TicI2CBus(TwoWire * bus = &Wire) : _tic(0, bus)
+  {
+  }
+
+  /// Points the bus's TicI2C object at the specified Tic and returns it.
+  TicI2C & operator[](TicHandle handle)
+  {
+    _tic.setAddress(handle.address);
+    _tic.setProduct((TicProduct)handle.product);
+    _tic.setVariableCache(nullptr);
+    _tic.setCommandShadow(nullptr);
+    return _tic;
+  }
+
+  /// Returns the bus's TicI2C object without changing which Tic it talks to.
+  TicI2C & getTic() { return _tic; }
+
+  /// Returns the error from the last communication on this bus.  See
+  /// TicBase::getLastError().
+  uint8_t getLastError() { return _tic.getLastError(); }
+
+private:
+  TicI2C _tic;
+};
+
+/// This class represents a Tic that is kept alive by a TicKeepalive object.
+/// You should create one of these for each Tic and pass it to
+/// TicKeepalive::add().
+class TicKeepaliveEntry
+{
+public:
+  /// Creates an entry for the specified Tic.
+  TicKeepaliveEntry(TicBase & tic) : _tic(&tic)
+  {
+  }
+
+private:
+  TicBase * const _tic;
+  TicKeepaliveEntry * _next = nullptr;
+  uint16_t _due = 0;
+
+  friend class TicKeepalive;
+};
+
+/// The longest interval, in milliseconds, that TicKeepalive supports.
+const uint16_t TicMaxKeepaliveInterval = 32767;
+
+/// This class prevents the "Command timeout" error on any number of Tics
+/// while sending as few commands as possible.
+///
+/// Any command resets the Tic's command timeout, so a Tic that is receiving
+/// other commands does not need "Reset command timeout" commands.  This class
+/// keeps track of when each Tic last received a command (see
+/// TicBase::getLastCommandTime()) and only sends "Reset command timeout" to a
+/// Tic that has been idle for the specified interval.
+///
+/// Example usage:
+/// ```
+/// TicKeepalive keepalive(500);  // Tic command timeout is 1000 ms
+/// TicKeepaliveEntry keepalive1(tic1);
+/// TicKeepaliveEntry keepalive2(tic2);
+///
+/// void setup()
+/// {
+///   keepalive.add(keepalive1);
+///   keepalive.add(keepalive2);
+/// }
+///
+/// void loop()
+/// {
+///   keepalive.update();
+///   // Send other commands here.
+/// }
+/// ```
+///
+/// The Tics are kept in a timing wheel: an array of lists of Tics that are due
+/// at about the same time.  Each call to update() only looks at the lists
+/// that have come due, so its cost does not depend on the total number of
+/// Tics.
+///
+/// A "Reset command timeout" command is sent between `interval` and
+/// `interval * 9 / 8` milliseconds after the last command, so the interval
+/// should be well below the Tic's command timeout setting.  You must call
+/// update() more often than that.
+class TicKeepalive
+{
+public:
+  /// Creates a new TicKeepalive that sends "Reset command timeout" to a Tic
+  /// after it has been idle for `interval` milliseconds.  Intervals longer
+  /// than ::TicMaxKeepaliveInterval are treated as
+  /// ::TicMaxKeepaliveInterval.
+  TicKeepalive(uint16_t interval);
+
+  /// Starts keeping the entry's Tic alive.
+  void add(TicKeepaliveEntry & entry);
+
+  /// Stops keeping the entry's Tic alive.
+  void remove(TicKeepaliveEntry & entry);
+
+  /// Sends "Reset command timeout" to the Tics that need it.  Call this
+  /// frequently, for example from your main loop.
+  void update();
+
+private:
+  static const uint8_t slotCount = 8;
+
+  uint16_t dueTime(TicBase * tic, uint16_t now);
+  void insert(TicKeepaliveEntry * entry);
+
+  TicKeepaliveEntry * _slots[slotCount] = {};
+  uint16_t _interval;
+  uint16_t _slotWidth;
+  uint16_t _slotEnd;
+  uint8_t _slot = 0;
+};
+
+/// A command waiting in a TicCommandQueue.
+struct TicQueuedCommand
+{
+  TicCommand cmd;
+  uint32_t val;
+};
+
+/// This class holds commands for one Tic and sends them when the bus has
+/// time for them, so that a program producing commands faster than the bus
+/// can carry them always sends up-to-date ones.
+///
+/// Commands that set a value, like "Set target velocity" or "Set max speed",
+/// replace a pending command of the same kind instead of waiting behind it,
+/// so only the newest value is sent.  "Set target position" and "Set target
+/// velocity" count as the same kind, since each one replaces the other.
+/// Other commands, like "Halt and set position" or "Energize", are sent in
+/// order, and a value is never moved ahead of or behind one of them.
+///
+/// Example usage:
+/// ```
+/// TicQueuedCommand ticQueueBuffer[8];
+/// TicCommandQueue ticQueue(tic, ticQueueBuffer, 8);
+///
+/// void setup()
+/// {
+///   // Send at most one command per millisecond.
+///   ticQueue.setInterval(1000);
+/// }
+///
+/// void loop()
+/// {
+///   ticQueue.setTargetVelocity(computeVelocity());
+///   ticQueue.update();
+/// }
+/// ```
+///
+/// The commands are sent with TicBase::sendCommand(), so the values are the
+/// raw values sent to the Tic.
+class TicCommandQueue
+{
+public:
+  /// Creates a queue for the specified Tic that stores up to `size` commands
+  /// in `buffer`.
+  TicCommandQueue(TicBase & tic, TicQueuedCommand * buffer, uint8_t size)
+    : _tic(&tic), _buffer(buffer), _size(size)
+  {
+  }
+
+  /// Adds a command to the queue, or replaces a pending command of the same
+  /// kind as described above.  Returns false if the queue was full, in which
+  /// case the command was not added.
+  bool push(TicCommand cmd, uint32_t val = 0);
+
+  /// Queues a "Set target position" command.
+  bool setTargetPosition(int32_t position)
+  {
+    return push(TicCommand::SetTargetPosition, position);
+  }
+
+  /// Queues a "Set target velocity" command.
+  bool setTargetVelocity(int32_t velocity)
+  {
+    return push(TicCommand::SetTargetVelocity, velocity);
+  }
+
+  /// Sets the minimum time between commands sent by update(), in
+  /// microseconds.  Setting this to the time the bus takes to carry one
+  /// command keeps the commands from piling up in the serial transmit buffer,
+  /// where they could no longer be replaced.  The default is 0.
+  void setInterval(uint16_t interval) { _interval = interval; }
+
+  /// Gets the interval set with setInterval().
+  uint16_t getInterval() { return _interval; }
+
+  /// Sends the oldest pending command if there is one and the interval has
+  /// passed since the last command.  Returns true if a command was sent.
+  bool update();
+
+  /// Sends every pending command right away.
+  void flush();
+
+  /// Discards every pending command.
+  void clear() { _count = 0; }
+
+  /// Returns the number of pending commands.
+  uint8_t getCount() { return _count; }
+
+  /// Returns the number of commands that replaced a pending command.
+  uint32_t getCoalesced() { return _coalesced; }
+
+private:
+  static uint8_t kindOf(TicCommand cmd, uint32_t val);
+  TicQueuedCommand & at(uint8_t index)
+  {
+    return _buffer[(_head + index) % _size];
+  }
+  void sendNext();
+
+  TicBase * const _tic;
+  TicQueuedCommand * const _buffer;
+  const uint8_t _size;
+  uint8_t _head = 0;
+  uint8_t _count = 0;
+  uint16_t _interval = 0;
+  uint32_t _lastSendTime = 0;
+  uint32_t _coalesced = 0;
+};
+
+/// The priority classes used by TicScheduler, from most to least important.
+enum class TicPriority : uint8_t
+{
+  Safety    = 0,
+  Motion    = 1,
+  Telemetry = 2,
+  Settings  = 3,
+};
+
+/// The number of values in ::TicPriority.
+const uint8_t TicPriorityCount = 4;
+
+/// The status of a TicScheduler work item that has not finished yet.  See
+/// TicScheduler::read().
+const uint8_t TicWorkPending = 0xFF;
+
+/// The status of a TicScheduler work item that was dropped because its
+/// deadline passed before it could be sent, or to make room for a
+/// TicPriority::Safety command.
+const uint8_t TicWorkExpired = 0xFE;
+
+/// The longest timeout, in milliseconds, that TicScheduler can keep for a
+/// piece of work.
+const uint16_t TicMaxWorkTimeout = 32767;
+
+/// A slot for one piece of work in a TicScheduler.  You should only need to
+/// allocate an array of these and pass it to the TicScheduler constructor.
+struct TicWorkItem
+{
+  TicBase * tic;
+  void * buffer;
+  uint8_t * status;
+  uint32_t val;
+  uint16_t deadline;
+  uint16_t sequence;
+  TicCommand cmd;
+  TicPriority priority;
+  uint8_t offset;
+  uint8_t length;
+  bool isRead;
+};
+
+/// This class decides the order in which commands and reads go out on a bus
+/// shared by many Tics.
+///
+/// Each piece of work has a ::TicPriority.  Every call to update() performs
+/// the most important piece of work, so a halt queued with halt() goes out
+/// before any pending telemetry reads, and the time it waits is bounded by
+/// the one command or read that might already be in progress.  Within a
+/// class, work with the earliest deadline goes first, and work without a
+/// deadline goes in the order it was queued.
+///
+/// Each class except TicPriority::Safety can be given a budget of bytes per
+/// period with setBudget().  A class that has used up its budget waits until
+/// the next period, which lets less important classes use the bus even when
+/// a more important one has plenty of work.  Work with a deadline is dropped
+/// if the deadline passes before it can be sent.
+///
+/// Example usage:
+/// ```
+/// TicWorkItem workItems[16];
+/// TicScheduler scheduler(workItems, 16);
+/// uint8_t positionBuffer[4];
+///
+/// void setup()
+/// {
+///   // Telemetry may use 200 bytes of bus time every 100 ms.
+///   scheduler.setBudget(TicPriority::Telemetry, 200, 100);
+/// }
+///
+/// void loop()
+/// {
+///   scheduler.command(TicPriority::Motion, tic1,
+///     TicCommand::SetTargetVelocity, 2000000, 20);
+///   scheduler.read(TicPriority::Telemetry, tic1, TicCommand::GetVariable,
+///     0x22, 4, positionBuffer, 50);
+///   if (emergency) { scheduler.halt(tic1); }
+///   scheduler.update();
+/// }
+/// ```
+///
+/// The Tics do not need to share a bus, but the scheduler only helps when
+/// they do.  Commands are sent with TicBase::sendCommand() and reads are done
+/// with TicBase::readBlock().
+class TicScheduler
+{
+public:
+  /// Creates a scheduler that can hold up to `size` pending pieces of work
+  /// in `items`.
+  TicScheduler(TicWorkItem * items, uint8_t size);
+
+  /// Queues a command.  The arguments after `tic` are the same as for
+  /// TicBase::sendCommand().  If `timeout` is not zero, the command is
+  /// dropped if it cannot be sent within that many milliseconds.  Timeouts
+  /// longer than ::TicMaxWorkTimeout are treated as ::TicMaxWorkTimeout.
+  ///
+  /// Queuing a TicPriority::Safety command drops any pending
+  /// TicPriority::Motion commands for the same Tic, so they cannot undo it.
+  /// If there is still no room, it drops the least important piece of work
+  /// that is not a TicPriority::Safety command: the one that would have been
+  /// done last.
+  ///
+  /// Returns false if there was no room for the command.
+  bool command(TicPriority priority, TicBase & tic, TicCommand cmd,
+    uint32_t val = 0, uint16_t timeout = 0);
+
+  /// Queues a read.  The arguments after `tic` are the same as for
+  /// TicBase::readBlock().  If `timeout` is not zero, the read is dropped if
+  /// it cannot be done within that many milliseconds.  Timeouts longer than
+  /// ::TicMaxWorkTimeout are treated as ::TicMaxWorkTimeout.
+  ///
+  /// If `status` is not `nullptr`, it is set to ::TicWorkPending now and to
+  /// the read's result later: the value of TicBase::getLastError(), or
+  /// ::TicWorkExpired.
+  ///
+  /// Returns false if there was no room for the read or `buffer` is
+  /// `nullptr`.
+  bool read(TicPriority priority, TicBase & tic, TicCommand cmd,
+    uint8_t offset, uint8_t length, void * buffer, uint16_t timeout = 0,
+    uint8_t * status = nullptr);
+
+  /// Queues a "Halt and hold" command for the Tic at TicPriority::Safety.
+  bool halt(TicBase & tic)
+  {
+    return command(TicPriority::Safety, tic, TicCommand::HaltAndHold);
+  }
+
+  /// Limits the class to `bytes` bytes of bus traffic, approximately, every
+  /// `period` milliseconds.  A budget of 0 bytes means no limit, which is the
+  /// default.  TicPriority::Safety is never limited.
+  void setBudget(TicPriority priority, uint16_t bytes, uint16_t period);
+
+  /// Performs the most important piece of work that is allowed to go now.
+  /// Returns true if there was one.  Call this frequently.
+  bool update();
+
+  /// Returns the number of pending pieces of work.
+  uint8_t getCount();
+
+  /// Returns the number of pieces of work dropped because their deadlines
+  /// passed.  Work dropped to make room for a TicPriority::Safety command is
+  /// counted by getEvicted() instead.
+  uint32_t getExpired() { return _expired; }
+
+  /// Returns the number of pieces of work dropped to make room for a
+  /// TicPriority::Safety command.  Their status is also set to
+  /// ::TicWorkExpired.
+  uint32_t getEvicted() { return _evicted; }
+
+private:
+  static uint8_t cost(const TicWorkItem & item);
+  bool earlier(const TicWorkItem & a, const TicWorkItem & b);
+  TicWorkItem * allocate(TicPriority priority, TicBase & tic, TicCommand cmd,
+    uint16_t timeout);
+  void finish(TicWorkItem & item, uint8_t status);
+  void evict();
+
+  TicWorkItem * const _items;
+  const uint8_t _size;
+  uint16_t _sequence = 0;
+  uint32_t _expired = 0;
+  uint32_t _evicted = 0;
+  uint16_t _budget[TicPriorityCount] = {};
+  uint16_t _period[TicPriorityCount] = {};
+  uint16_t _used[TicPriorityCount] = {};
+  uint16_t _periodStart[TicPriorityCount] = {};
 };
@@ -30,19 +30,22 @@ SoftwareSerial ticSerial(10, 11);
 TicSerial tic1(ticSerial, 14);
 TicSerial tic2(ticSerial, 15);
 
+// This group sends commands that apply to both Tics, like "Reset
+// command timeout", as a single compact protocol frame.
+TicSerial * const tics[] = { &tic1, &tic2 };
+TicSerialGroup allTics(ticSerial, tics, 2);
+
 void setup()
 {
   ticSerial.begin(9600);
   delay(20);
 
-  tic1.exitSafeStart();
-  tic2.exitSafeStart();
+  allTics.exitSafeStart();
 }
 
 void resetCommandTimeout()
 {
-  tic1.resetCommandTimeout();
-  tic2.resetCommandTimeout();
+  allTics.resetCommandTimeout();
 }
 
 void delayWhileResettingCommandTimeout(uint32_t ms)
@@ -0,0 +1,452 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+// Measures what each public TicBase method costs on the wire.  Every method
+// is called through TicSerial (compact and Pololu protocols) and TicI2C
+// against the simulator, and the program prints one row per method and bus
+// speed.  Methods are called through a TicBase reference, except for the
+// rows named TicT::..., which call the non-virtual TicT versions of the
+// streaming commands directly.  Rows named .../cacheHit and .../cacheMiss
+// read through a TicVariableCache.  The columns are:
+//
+// - bytes_out, bytes_in: bytes written to and read from the bus.
+// - transactions: serial commands received by the Tic, or I2C transactions.
+// - latency_us: modelled time from the call until its last byte is on the
+//   wire and any response has been read.
+// - calls_per_s: 1e6 / latency_us, the most times per second the call fits
+//   on the bus.  Divide by the calls per axis per update to size a bus.
+// - cpu_ns: host CPU time per call against a transport that does nothing,
+//   which measures the library's encoding and decoding.
+//
+// Usage: tic_bench [-f csv|tsv] [-b baud,...] [-i clock,...] [-n iterations]
+
+#include <TicSim.h>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct BenchCall
+{
+  const char * name;
+  void (*run)(TicBase &);
+};
+
+static constexpr TicVariableMask statusMask =
+  ticVariableBit(TicVariable::CurrentPosition) |
+  ticVariableBit(TicVariable::CurrentVelocity) |
+  ticVariableBit(TicVariable::MiscFlags1);
+
+static TicVariableCache cache(60000);
+
+static const BenchCall calls[] = {
+  { "setTargetPosition", [](TicBase & t) { t.setTargetPosition(-100000); } },
+  { "setTargetVelocity", [](TicBase & t) { t.setTargetVelocity(2000000); } },
+  { "haltAndSetPosition", [](TicBase & t) { t.haltAndSetPosition(0); } },
+  { "haltAndHold", [](TicBase & t) { t.haltAndHold(); } },
+  { "goHomeReverse", [](TicBase & t) { t.goHomeReverse(); } },
+  { "goHomeForward", [](TicBase & t) { t.goHomeForward(); } },
+  { "resetCommandTimeout", [](TicBase & t) { t.resetCommandTimeout(); } },
+  { "deenergize", [](TicBase & t) { t.deenergize(); } },
+  { "energize", [](TicBase & t) { t.energize(); } },
+  { "exitSafeStart", [](TicBase & t) { t.exitSafeStart(); } },
+  { "enterSafeStart", [](TicBase & t) { t.enterSafeStart(); } },
+  { "reset", [](TicBase & t) { t.reset(); } },
+  { "clearDriverError", [](TicBase & t) { t.clearDriverError(); } },
+  { "setMaxSpeed", [](TicBase & t) { t.setMaxSpeed(2000000); } },
+  { "setStartingSpeed", [](TicBase & t) { t.setStartingSpeed(0); } },
+  { "setMaxAccel", [](TicBase & t) { t.setMaxAccel(40000); } },
+  { "setMaxDecel", [](TicBase & t) { t.setMaxDecel(40000); } },
+  { "setStepMode", [](TicBase & t) { t.setStepMode(TicStepMode::Full); } },
+  { "setCurrentLimit", [](TicBase & t) { t.setCurrentLimit(1000); } },
+  { "setCurrentLimitCode", [](TicBase & t) { t.setCurrentLimitCode(20); } },
+  { "setDecayMode", [](TicBase & t) { t.setDecayMode(TicDecayMode::Fast); } },
+  { "setAgcMode", [](TicBase & t) { t.setAgcMode(TicAgcMode::On); } },
+  { "setAgcBottomCurrentLimit", [](TicBase & t) {
+    t.setAgcBottomCurrentLimit(TicAgcBottomCurrentLimit::P50); } },
+  { "setAgcCurrentBoostSteps", [](TicBase & t) {
+    t.setAgcCurrentBoostSteps(TicAgcCurrentBoostSteps::S5); } },
+  { "setAgcFrequencyLimit", [](TicBase & t) {
+    t.setAgcFrequencyLimit(TicAgcFrequencyLimit::F675Hz); } },
+  { "getOperationState", [](TicBase & t) { t.getOperationState(); } },
+  { "getEnergized", [](TicBase & t) { t.getEnergized(); } },
+  { "getPositionUncertain", [](TicBase & t) { t.getPositionUncertain(); } },
+  { "getForwardLimitActive", [](TicBase & t) { t.getForwardLimitActive(); } },
+  { "getReverseLimitActive", [](TicBase & t) { t.getReverseLimitActive(); } },
+  { "getHomingActive", [](TicBase & t) { t.getHomingActive(); } },
+  { "getErrorStatus", [](TicBase & t) { t.getErrorStatus(); } },
+  { "getErrorsOccurred", [](TicBase & t) { t.getErrorsOccurred(); } },
+  { "getPlanningMode", [](TicBase & t) { t.getPlanningMode(); } },
+  { "getTargetPosition", [](TicBase & t) { t.getTargetPosition(); } },
+  { "getTargetVelocity", [](TicBase & t) { t.getTargetVelocity(); } },
+  { "getMaxSpeed", [](TicBase & t) { t.getMaxSpeed(); } },
+  { "getStartingSpeed", [](TicBase & t) { t.getStartingSpeed(); } },
+  { "getMaxAccel", [](TicBase & t) { t.getMaxAccel(); } },
+  { "getMaxDecel", [](TicBase & t) { t.getMaxDecel(); } },
+  { "getCurrentPosition", [](TicBase & t) { t.getCurrentPosition(); } },
+  { "getCurrentVelocity", [](TicBase & t) { t.getCurrentVelocity(); } },
+  { "getActingTargetPosition", [](TicBase & t) {
+    t.getActingTargetPosition(); } },
+  { "getTimeSinceLastStep", [](TicBase & t) { t.getTimeSinceLastStep(); } },
+  { "getDeviceReset", [](TicBase & t) { t.getDeviceReset(); } },
+  { "getVinVoltage", [](TicBase & t) { t.getVinVoltage(); } },
+  { "getUpTime", [](TicBase & t) { t.getUpTime(); } },
+  { "getEncoderPosition", [](TicBase & t) { t.getEncoderPosition(); } },
+  { "getRCPulseWidth", [](TicBase & t) { t.getRCPulseWidth(); } },
+  { "getAnalogReading", [](TicBase & t) { t.getAnalogReading(TicPin::SDA); } },
+  { "getDigitalReading", [](TicBase & t) {
+    t.getDigitalReading(TicPin::SDA); } },
+  { "getPinState", [](TicBase & t) { t.getPinState(TicPin::SDA); } },
+  { "getStepMode", [](TicBase & t) { t.getStepMode(); } },
+  { "getCurrentLimit", [](TicBase & t) { t.getCurrentLimit(); } },
+  { "getCurrentLimitCode", [](TicBase & t) { t.getCurrentLimitCode(); } },
+  { "getDecayMode", [](TicBase & t) { t.getDecayMode(); } },
+  { "getInputState", [](TicBase & t) { t.getInputState(); } },
+  { "getInputAfterAveraging", [](TicBase & t) {
+    t.getInputAfterAveraging(); } },
+  { "getInputAfterHysteresis", [](TicBase & t) {
+    t.getInputAfterHysteresis(); } },
+  { "getInputAfterScaling", [](TicBase & t) { t.getInputAfterScaling(); } },
+  { "getLastMotorDriverError", [](TicBase & t) {
+    t.getLastMotorDriverError(); } },
+  { "getAgcMode", [](TicBase & t) { t.getAgcMode(); } },
+  { "getAgcBottomCurrentLimit", [](TicBase & t) {
+    t.getAgcBottomCurrentLimit(); } },
+  { "getAgcCurrentBoostSteps", [](TicBase & t) {
+    t.getAgcCurrentBoostSteps(); } },
+  { "getAgcFrequencyLimit", [](TicBase & t) { t.getAgcFrequencyLimit(); } },
+  { "getLastHpDriverErrors", [](TicBase & t) { t.getLastHpDriverErrors(); } },
+  { "getVariables", [](TicBase & t) { TicVariables v; t.getVariables(v); } },
+  { "getVariables/mask", [](TicBase & t) {
+    TicVariables v; t.getVariables(v, statusMask); } },
+  { "getVariables/plan", [](TicBase & t) {
+    TicVariables v; t.getVariables<statusMask>(v); } },
+  { "getCurrentPosition/cacheHit", [](TicBase & t) {
+    t.setVariableCache(&cache); t.getCurrentPosition(); } },
+  { "getCurrentPosition/cacheMiss", [](TicBase & t) {
+    t.setVariableCache(&cache); cache.invalidate(); t.getCurrentPosition(); } },
+  { "readBlock", [](TicBase & t) {
+    uint8_t b[4]; t.readBlock(TicCommand::GetVariable, 0x22, sizeof(b), b); } },
+  { "sendCommand", [](TicBase & t) {
+    t.sendCommand(TicCommand::SetTargetVelocity, 2000000); } },
+  { "getSetting", [](TicBase & t) {
+    uint8_t b[4]; t.getSetting(0x47, sizeof(b), b); } },
+  { "reloadSettings", [](TicBase & t) {
+    TicSettings s; t.reloadSettings(s); } },
+};
+
+static const size_t callCount = sizeof(calls) / sizeof(calls[0]);
+
+struct DirectCall
+{
+  const char * name;
+  void (*serial)(TicSerial &);
+  void (*i2c)(TicI2C &);
+};
+
+static const DirectCall directCalls[] = {
+  { "TicT::setTargetPosition",
+    [](TicSerial & t) { t.setTargetPosition(-100000); },
+    [](TicI2C & t) { t.setTargetPosition(-100000); } },
+  { "TicT::setTargetVelocity",
+    [](TicSerial & t) { t.setTargetVelocity(2000000); },
+    [](TicI2C & t) { t.setTargetVelocity(2000000); } },
+  { "TicT::haltAndSetPosition",
+    [](TicSerial & t) { t.haltAndSetPosition(0); },
+    [](TicI2C & t) { t.haltAndSetPosition(0); } },
+  { "TicT::haltAndHold",
+    [](TicSerial & t) { t.haltAndHold(); },
+    [](TicI2C & t) { t.haltAndHold(); } },
+  { "TicT::resetCommandTimeout",
+    [](TicSerial & t) { t.resetCommandTimeout(); },
+    [](TicI2C & t) { t.resetCommandTimeout(); } },
+};
+
+static const size_t rowCount = callCount +
+  sizeof(directCalls) / sizeof(directCalls[0]);
+
+static const char * rowName(size_t row)
+{
+  if (row < callCount) { return calls[row].name; }
+  return directCalls[row - callCount].name;
+}
+
+// Runs the call for the row.  Exactly one of `serial` and `i2c` must be
+// non-null.
+static void runRow(size_t row, TicSerial * serial, TicI2C * i2c)
+{
+  if (row < callCount)
+  {
+    calls[row].run(serial ? (TicBase &)*serial : (TicBase &)*i2c);
+    return;
+  }
+  const DirectCall & call = directCalls[row - callCount];
+  if (serial) { call.serial(*serial); }
+  else { call.i2c(*i2c); }
+}
+
+// Runs the call for the row once without measuring it, so that the cache is
+// warm for the cacheHit row, after detaching the cache left by earlier rows.
+static void warmUpRow(size_t row, TicSerial * serial, TicI2C * i2c)
+{
+  TicBase & tic = serial ? (TicBase &)*serial : (TicBase &)*i2c;
+  tic.setVariableCache(nullptr);
+  runRow(row, serial, i2c);
+}
+
+/// A serial port that discards what is written and answers every read with
+/// zeros, so that only the library's own work is timed.
+class NullStream : public Stream
+{
+public:
+  size_t write(uint8_t) override { return 1; }
+  int available() override { return 1; }
+  int read() override { return 0; }
+  int peek() override { return 0; }
+};
+
+/// The I2C counterpart of NullStream.
+class NullI2C : public TwoWireBackend
+{
+public:
+  uint8_t write(uint8_t, const uint8_t *, uint8_t, bool) override
+  {
+    return 0;
+  }
+
+  uint8_t read(uint8_t, uint8_t * data, uint8_t length, bool) override
+  {
+    memset(data, 0, length);
+    return length;
+  }
+};
+
+struct Result
+{
+  uint64_t bytesOut = 0;
+  uint64_t bytesIn = 0;
+  uint64_t transactions = 0;
+  uint64_t latency = 0;
+  double cpu = 0;
+};
+
+enum class Transport { Compact, Pololu, I2C };
+
+static const char * transportName(Transport transport)
+{
+  switch (transport)
+  {
+  case Transport::Compact: return "serial_compact";
+  case Transport::Pololu: return "serial_pololu";
+  default: return "i2c";
+  }
+}
+
+// Times each call against a transport that does nothing.  A simulator with
+// no buses provides the clock, so delays in the library take no real time.
+static std::vector<double> measureCpu(Transport transport, uint32_t iterations)
+{
+  TicSim sim;
+  NullStream stream;
+  NullI2C nullI2C;
+  Wire.setBackend(&nullI2C);
+  TicSerial serialTic(stream, transport == Transport::Pololu ? 14 : 255);
+  TicI2C i2cTic(14);
+  TicSerial * serial = transport == Transport::I2C ? nullptr : &serialTic;
+  TicI2C * i2c = transport == Transport::I2C ? &i2cTic : nullptr;
+
+  std::vector<double> result;
+  for (size_t i = 0; i < rowCount; i++)
+  {
+    warmUpRow(i, serial, i2c);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < iterations; n++) { runRow(i, serial, i2c); }
+    std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+    result.push_back(elapsed.count() / iterations);
+  }
+  Wire.setBackend(nullptr);
+  return result;
+}
+
+static std::vector<Result> measureSerial(bool pololu, uint32_t baudRate)
+{
+  TicSim sim;
+  TicSimSerialBus bus(sim, baudRate);
+  TicSimDevice device(14);
+  device.setCommandTimeout(0);
+  bus.attach(device);
+  TicSerial tic(bus, pololu ? 14 : 255);
+
+  std::vector<Result> results;
+  for (size_t i = 0; i < rowCount; i++)
+  {
+    warmUpRow(i, &tic, nullptr);
+    sim.advanceTo(bus.getTxIdleTime());
+
+    Result r;
+    uint64_t bytesOut = bus.getBytesWritten();
+    uint64_t bytesIn = bus.getBytesRead();
+    uint32_t commands = device.getCommandCount();
+    uint64_t start = sim.now();
+
+    runRow(i, &tic, nullptr);
+    sim.advanceTo(bus.getTxIdleTime());
+
+    r.bytesOut = bus.getBytesWritten() - bytesOut;
+    r.bytesIn = bus.getBytesRead() - bytesIn;
+    r.transactions = device.getCommandCount() - commands;
+    r.latency = sim.now() - start;
+    results.push_back(r);
+  }
+  return results;
+}
+
+// Counts the bytes on an I2C bus, including address bytes, by wrapping the
+// simulated bus.
+class CountingI2C : public TwoWireBackend
+{
+public:
+  CountingI2C(TwoWireBackend & bus) : bus(bus) { }
+
+  uint8_t write(uint8_t address, const uint8_t * data, uint8_t length,
+    bool sendStop) override
+  {
+    bytesOut += 1 + length;
+    return bus.write(address, data, length, sendStop);
+  }
+
+  uint8_t read(uint8_t address, uint8_t * data, uint8_t length,
+    bool sendStop) override
+  {
+    bytesOut += 1;
+    uint8_t count = bus.read(address, data, length, sendStop);
+    bytesIn += count;
+    return count;
+  }
+
+  TwoWireBackend & bus;
+  uint64_t bytesOut = 0;
+  uint64_t bytesIn = 0;
+};
+
+static std::vector<Result> measureI2C(uint32_t clock)
+{
+  TicSim sim;
+  TicSimI2CBus bus(sim, clock);
+  CountingI2C counter(bus);
+  TicSimDevice device(14);
+  device.setCommandTimeout(0);
+  bus.attach(device);
+  Wire.setBackend(&counter);
+  TicI2C tic(14);
+
+  std::vector<Result> results;
+  for (size_t i = 0; i < rowCount; i++)
+  {
+    warmUpRow(i, nullptr, &tic);
+
+    Result r;
+    uint64_t bytesOut = counter.bytesOut;
+    uint64_t bytesIn = counter.bytesIn;
+    uint64_t transactions = bus.getTransactions();
+    uint64_t start = sim.now();
+
+    runRow(i, nullptr, &tic);
+
+    r.bytesOut = counter.bytesOut - bytesOut;
+    r.bytesIn = counter.bytesIn - bytesIn;
+    r.transactions = bus.getTransactions() - transactions;
+    r.latency = sim.now() - start;
+    results.push_back(r);
+  }
+  Wire.setBackend(nullptr);
+  return results;
+}
+
+static std::vector<uint32_t> parseList(const char * text)
+{
+  std::vector<uint32_t> list;
+  while (*text)
+  {
+    char * end;
+    list.push_back(strtoul(text, &end, 10));
+    text = *end ? end + 1 : end;
+  }
+  return list;
+}
+
+static void usage()
+{
+  fprintf(stderr,
+    "usage: tic_bench [-f csv|tsv] [-b baud,...] [-i clock,...] "
+    "[-n iterations]\n");
+  exit(2);
+}
+
+int main(int argc, char ** argv)
+{
+  char separator = ',';
+  std::vector<uint32_t> baudRates = { 9600, 115200 };
+  std::vector<uint32_t> clocks = { 100000, 400000 };
+  uint32_t iterations = 10000;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (i + 1 >= argc) { usage(); }
+    const char * value = argv[++i];
+    if (!strcmp(argv[i - 1], "-f"))
+    {
+      if (!strcmp(value, "csv")) { separator = ','; }
+      else if (!strcmp(value, "tsv")) { separator = '\t'; }
+      else { usage(); }
+    }
+    else if (!strcmp(argv[i - 1], "-b")) { baudRates = parseList(value); }
+    else if (!strcmp(argv[i - 1], "-i")) { clocks = parseList(value); }
+    else if (!strcmp(argv[i - 1], "-n")) { iterations = atol(value); }
+    else { usage(); }
+  }
+  if (iterations == 0) { iterations = 1; }
+
+  const char * columns[] = { "transport", "rate", "call", "bytes_out",
+    "bytes_in", "transactions", "latency_us", "calls_per_s", "cpu_ns" };
+  for (size_t i = 0; i < sizeof(columns) / sizeof(columns[0]); i++)
+  {
+    printf("%s%s", i ? std::string(1, separator).c_str() : "", columns[i]);
+  }
+  printf("\n");
+
+  Transport transports[] = {
+    Transport::Compact, Transport::Pololu, Transport::I2C };
+  for (Transport transport : transports)
+  {
+    std::vector<double> cpu = measureCpu(transport, iterations);
+    const std::vector<uint32_t> & rates =
+      transport == Transport::I2C ? clocks : baudRates;
+
+    for (uint32_t rate : rates)
+    {
+      if (rate == 0) { continue; }
+      std::vector<Result> results = transport == Transport::I2C ?
+        measureI2C(rate) :
+        measureSerial(transport == Transport::Pololu, rate);
+
+      for (size_t i = 0; i < rowCount; i++)
+      {
+        const Result & r = results[i];
+        printf("%s%c%lu%c%s%c%llu%c%llu%c%llu%c%llu%c%.1f%c%.1f\n",
+          transportName(transport), separator,
+          (unsigned long)rate, separator,
+          rowName(i), separator,
+          (unsigned long long)r.bytesOut, separator,
+          (unsigned long long)r.bytesIn, separator,
+          (unsigned long long)r.transactions, separator,
+          (unsigned long long)r.latency, separator,
+          r.latency ? 1e6 / r.latency : 0.0, separator,
+          cpu[i]);
+      }
+    }
+  }
+  return 0;
+}
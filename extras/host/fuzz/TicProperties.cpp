@@ -0,0 +1,631 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+// Property checks for the library's protocol encoders and current limit
+// conversions.
+//
+// The constexpr parts of the library (TicFrameBuilder and TicCurrentLimit)
+// are checked with static_assert, so this file does not compile if they
+// break.  The rest is checked at run time: each input selects a transport,
+// a command or read, and its arguments, sends it through the library to a
+// mock Tic, and checks the bytes with a reference decoder written
+// separately from the library's encoders.
+//
+// Built normally, this is the tic_properties program, which checks every
+// current limit for every product and then runs random inputs:
+//
+//   tic_properties [iterations] [seed]
+//
+// Built with -DTIC_FUZZER and -fsanitize=fuzzer, it is a libFuzzer target.
+
+#include <Tic.h>
+#include <deque>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+/**** Compile-time checks ****/
+
+// A bitwise CRC-7 (polynomial 0x91, least-significant bit first).
+static constexpr uint8_t crcBits(uint8_t crc, uint8_t bits)
+{
+  return bits == 0 ? crc :
+    crcBits((crc & 1) ? (crc ^ 0x91) >> 1 : crc >> 1, bits - 1);
+}
+
+static constexpr uint8_t crcOf(const TicFrame & f, uint8_t length,
+  uint8_t i = 0, uint8_t crc = 0)
+{
+  return i == length ? crc : crcOf(f, length, i + 1, crcBits(crc ^ f.data[i], 8));
+}
+
+static constexpr bool dataBytesClear(const TicFrame & f, uint8_t i)
+{
+  return i >= f.length || (!(f.data[i] & 0x80) && dataBytesClear(f, i + 1));
+}
+
+static constexpr uint8_t headerOf(const TicFrame & f)
+{
+  return f.data[0] == 0xAA ? 3 : 1;
+}
+
+static constexpr uint32_t w32Of(const TicFrame & f)
+{
+  return (uint32_t)(f.data[headerOf(f) + 1] | (f.data[headerOf(f)] & 1) << 7) |
+    (uint32_t)(f.data[headerOf(f) + 2] | (f.data[headerOf(f)] & 2) << 6) << 8 |
+    (uint32_t)(f.data[headerOf(f) + 3] | (f.data[headerOf(f)] & 4) << 5) << 16 |
+    (uint32_t)(f.data[headerOf(f) + 4] | (f.data[headerOf(f)] & 8) << 4) << 24;
+}
+
+// Checks that a W32 frame decodes to the value it was built from.
+static constexpr bool w32RoundTrip(uint32_t val, uint8_t device, bool crc)
+{
+  return w32Of(TicFrameBuilder::w32(TicCommand::SetTargetVelocity, val,
+      device, crc)) == val &&
+    TicFrameBuilder::w32(TicCommand::SetTargetVelocity, val,
+      device, crc).length == headerOf(TicFrameBuilder::w32(
+      TicCommand::SetTargetVelocity, val, device, crc)) + 5 + crc &&
+    dataBytesClear(TicFrameBuilder::w32(TicCommand::SetTargetVelocity, val,
+      device, crc), 1) &&
+    (!crc || crcOf(TicFrameBuilder::w32(TicCommand::SetTargetVelocity, val,
+      device, crc), headerOf(TicFrameBuilder::w32(
+      TicCommand::SetTargetVelocity, val, device, crc)) + 5) ==
+      TicFrameBuilder::w32(TicCommand::SetTargetVelocity, val, device,
+      crc).data[headerOf(TicFrameBuilder::w32(
+      TicCommand::SetTargetVelocity, val, device, crc)) + 5]);
+}
+
+static constexpr bool w32AllModes(uint32_t val)
+{
+  return w32RoundTrip(val, 255, false) && w32RoundTrip(val, 255, true) &&
+    w32RoundTrip(val, 14, false) && w32RoundTrip(val, 14, true) &&
+    w32RoundTrip(val, 0x7F, true);
+}
+
+static_assert(w32AllModes(0), "");
+static_assert(w32AllModes(0x7F), "");
+static_assert(w32AllModes(0x80), "");
+static_assert(w32AllModes(0x80808080), "");
+static_assert(w32AllModes(0x7F7F7F7F), "");
+static_assert(w32AllModes(0xFFFFFFFF), "");
+static_assert(w32AllModes(-123456), "");
+static_assert(w32AllModes(0x12345678), "");
+
+static_assert(TicFrameBuilder::w7(TicCommand::SetStepMode, 0xFF).data[1] ==
+  0x7F, "W7 data must have its most-significant bit cleared.");
+static_assert(TicFrameBuilder::quick(TicCommand::Reset, 0x8E).data[1] ==
+  0x0E, "The device number must have its most-significant bit cleared.");
+static_assert(crcOf(TicFrameBuilder::quick(TicCommand::HaltAndHold, 14, true),
+  3) == TicFrameBuilder::quick(TicCommand::HaltAndHold, 14, true).data[3],
+  "");
+
+// Current limits.  For every code, its current converts back to it, and one
+// milliamp less converts to the code below, so toCode() picks the highest
+// code whose current is at most the request.  (tic_properties checks every
+// milliamp value at run time.)
+
+template <TicProduct P>
+static constexpr bool codeValid(uint8_t code)
+{
+  return TicCurrentLimit<P>::toCode(TicCurrentLimit<P>::fromCode(code)) ==
+      code &&
+    (code == 0 ||
+      (TicCurrentLimit<P>::fromCode(code - 1) <
+        TicCurrentLimit<P>::fromCode(code) &&
+      TicCurrentLimit<P>::toCode(TicCurrentLimit<P>::fromCode(code) - 1) ==
+        code - 1));
+}
+
+template <TicProduct P>
+static constexpr bool codesValid(uint8_t code, uint8_t maxCode)
+{
+  return code > maxCode ||
+    (codeValid<P>(code) && codesValid<P>(code + 1, maxCode));
+}
+
+template <TicProduct P>
+static constexpr bool currentLimitValid(uint8_t maxCode)
+{
+  return codesValid<P>(0, maxCode) &&
+    TicCurrentLimit<P>::toCode(0) == 0 &&
+    TicCurrentLimit<P>::toCode(0xFFFF) == maxCode;
+}
+
+static_assert(currentLimitValid<TicProduct::T825>(127), "");
+static_assert(currentLimitValid<TicProduct::T249>(127), "");
+static_assert(currentLimitValid<TicProduct::T500>(32), "");
+static_assert(currentLimitValid<TicProduct::Tic36v4>(127), "");
+
+/**** Run-time checks ****/
+
+static const uint8_t * currentInput;
+static size_t currentInputSize;
+
+static void check(bool condition, const char * what)
+{
+  if (condition) { return; }
+  fprintf(stderr, "property failed: %s\ninput:", what);
+  for (size_t i = 0; i < currentInputSize; i++)
+  {
+    fprintf(stderr, " %02x", currentInput[i]);
+  }
+  fprintf(stderr, "\n");
+  abort();
+}
+
+static uint8_t referenceCrc(const uint8_t * data, size_t length)
+{
+  uint8_t crc = 0;
+  for (size_t i = 0; i < length; i++)
+  {
+    crc = crcBits(crc ^ data[i], 8);
+  }
+  return crc;
+}
+
+/// A command or read request decoded by the reference decoder.
+struct Decoded
+{
+  uint8_t device = 255;
+  uint8_t cmd = 0;
+  uint32_t val = 0;
+  uint8_t offset = 0;
+  uint8_t length = 0;
+};
+
+static int dataLengthOf(uint8_t cmd)
+{
+  switch (cmd >> 4)
+  {
+  case 0x8: case 0xB: return 0;
+  case 0x9: return 1;
+  case 0xA: return 2;
+  case 0xE: return 5;
+  default: return -1;
+  }
+}
+
+// Decodes one serial frame.  Returns its length, or 0 if more bytes are
+// needed.  Fails the check if the bytes are not a valid frame.
+static size_t decodeSerial(const uint8_t * d, size_t n, bool crc,
+  Decoded & out)
+{
+  size_t header = 1;
+  if (d[0] == 0xAA)
+  {
+    if (n < 3) { return 0; }
+    check(!(d[1] & 0x80) && !(d[2] & 0x80), "Pololu header bytes");
+    out.device = d[1];
+    out.cmd = d[2] | 0x80;
+    header = 3;
+  }
+  else
+  {
+    check(d[0] & 0x80, "command byte has its MSB set");
+    out.device = 255;
+    out.cmd = d[0];
+  }
+
+  int dataLength = dataLengthOf(out.cmd);
+  check(dataLength >= 0, "known command format");
+  size_t length = header + dataLength + crc;
+  if (n < length) { return 0; }
+
+  for (size_t i = header; i < length; i++)
+  {
+    check(!(d[i] & 0x80), "data bytes have their MSB cleared");
+  }
+  if (crc)
+  {
+    check(referenceCrc(d, length - 1) == d[length - 1], "command CRC");
+  }
+
+  const uint8_t * p = d + header;
+  switch (dataLength)
+  {
+  case 1:
+    out.val = p[0];
+    break;
+  case 2:
+    out.offset = p[0] | (p[1] & 0x40) << 1;
+    out.length = p[1] & 0x3F;
+    check(!(p[1] & 0x80), "read length byte");
+    break;
+  case 5:
+    check(p[0] <= 0x0F, "W32 MSB byte uses only 4 bits");
+    out.val = 0;
+    for (uint8_t i = 0; i < 4; i++)
+    {
+      out.val |= (uint32_t)(p[1 + i] | ((p[0] >> i) & 1) << 7) << (8 * i);
+    }
+    break;
+  }
+  return length;
+}
+
+/// A Tic on a serial port: it decodes everything the library writes and
+/// answers reads from its memory.
+class MockSerial : public Stream
+{
+public:
+  size_t write(uint8_t byte) override
+  {
+    written.push_back(byte);
+    Decoded frame;
+    size_t length = decodeSerial(written.data() + parsed,
+      written.size() - parsed, crcForCommands, frame);
+    if (length)
+    {
+      parsed += length;
+      frames.push_back(frame);
+      if (dataLengthOf(frame.cmd) == 2) { respond(frame); }
+    }
+    return 1;
+  }
+
+  int available() override { return rx.size(); }
+
+  int read() override
+  {
+    if (rx.empty()) { return -1; }
+    uint8_t byte = rx.front();
+    rx.pop_front();
+    return byte;
+  }
+
+  int peek() override { return rx.empty() ? -1 : rx.front(); }
+
+  void reset()
+  {
+    written.clear();
+    parsed = 0;
+    frames.clear();
+    rx.clear();
+  }
+
+  bool crcForCommands = false;
+  bool crcForResponses = false;
+  uint8_t memory[256];
+  std::vector<uint8_t> written;
+  size_t parsed = 0;
+  std::vector<Decoded> frames;
+  std::deque<uint8_t> rx;
+
+private:
+  void respond(const Decoded & frame)
+  {
+    std::vector<uint8_t> response;
+    for (uint8_t i = 0; i < frame.length; i++)
+    {
+      response.push_back(memory[(uint8_t)(frame.offset + i)]);
+    }
+    if (crcForResponses)
+    {
+      response.push_back(referenceCrc(response.data(), response.size()));
+    }
+    rx.insert(rx.end(), response.begin(), response.end());
+  }
+};
+
+/// A Tic on an I2C bus.
+class MockI2C : public TwoWireBackend
+{
+public:
+  uint8_t write(uint8_t address, const uint8_t * data, uint8_t length,
+    bool sendStop) override
+  {
+    check(length >= 1, "I2C write has a command byte");
+    Decoded frame;
+    frame.device = address;
+    frame.cmd = data[0];
+    int dataLength = dataLengthOf(frame.cmd);
+    check(dataLength >= 0, "known I2C command");
+    switch (dataLength)
+    {
+    case 0:
+      check(length == 1, "I2C quick command length");
+      break;
+    case 1:
+      check(length == 2, "I2C W7 command length");
+      check(!(data[1] & 0x80), "I2C W7 data has its MSB cleared");
+      frame.val = data[1];
+      break;
+    case 2:
+      check(length == 2, "I2C read request length");
+      check(!sendStop, "I2C read request uses a repeated start");
+      frame.offset = data[1];
+      break;
+    case 5:
+      check(length == 5, "I2C W32 command length");
+      frame.val = (uint32_t)data[1] | (uint32_t)data[2] << 8 |
+        (uint32_t)data[3] << 16 | (uint32_t)data[4] << 24;
+      break;
+    }
+    frames.push_back(frame);
+    return 0;
+  }
+
+  uint8_t read(uint8_t address, uint8_t * data, uint8_t length,
+    bool sendStop) override
+  {
+    (void)sendStop;
+    check(!frames.empty() && frames.back().device == address &&
+      dataLengthOf(frames.back().cmd) == 2, "I2C read follows a request");
+    frames.back().length = length;
+    for (uint8_t i = 0; i < length; i++)
+    {
+      data[i] = memory[(uint8_t)(frames.back().offset + i)];
+    }
+    return length;
+  }
+
+  uint8_t memory[256];
+  std::vector<Decoded> frames;
+};
+
+static const TicCommand writeCommands[] = {
+  TicCommand::SetTargetPosition,
+  TicCommand::SetTargetVelocity,
+  TicCommand::HaltAndSetPosition,
+  TicCommand::HaltAndHold,
+  TicCommand::GoHome,
+  TicCommand::ResetCommandTimeout,
+  TicCommand::Deenergize,
+  TicCommand::Energize,
+  TicCommand::ExitSafeStart,
+  TicCommand::EnterSafeStart,
+  TicCommand::Reset,
+  TicCommand::ClearDriverError,
+  TicCommand::SetSpeedMax,
+  TicCommand::SetStartingSpeed,
+  TicCommand::SetAccelMax,
+  TicCommand::SetDecelMax,
+  TicCommand::SetStepMode,
+  TicCommand::SetCurrentLimit,
+  TicCommand::SetDecayMode,
+  TicCommand::SetAgcOption,
+};
+
+static const TicProduct products[] = {
+  TicProduct::T825, TicProduct::T834, TicProduct::T500, TicProduct::T249,
+  TicProduct::Tic36v4,
+};
+
+static uint8_t toCode(TicProduct product, uint16_t mA)
+{
+  switch (product)
+  {
+  case TicProduct::T500: return TicCurrentLimit<TicProduct::T500>::toCode(mA);
+  case TicProduct::T249: return TicCurrentLimit<TicProduct::T249>::toCode(mA);
+  case TicProduct::Tic36v4:
+    return TicCurrentLimit<TicProduct::Tic36v4>::toCode(mA);
+  default: return TicCurrentLimit<TicProduct::T825>::toCode(mA);
+  }
+}
+
+static uint16_t fromCode(TicProduct product, uint8_t code)
+{
+  switch (product)
+  {
+  case TicProduct::T500:
+    return TicCurrentLimit<TicProduct::T500>::fromCode(code);
+  case TicProduct::T249:
+    return TicCurrentLimit<TicProduct::T249>::fromCode(code);
+  case TicProduct::Tic36v4:
+    return TicCurrentLimit<TicProduct::Tic36v4>::fromCode(code);
+  default: return TicCurrentLimit<TicProduct::T825>::fromCode(code);
+  }
+}
+
+/// Virtual time, so that delays in the library (like the one after a reset)
+/// take no real time.
+class InstantClock : public HostClock
+{
+public:
+  uint64_t now() override { return time; }
+  void waitUntil(uint64_t t) override { if (t > time) { time = t; } }
+  void idle() override { time += 100; }
+
+  uint64_t time = 0;
+};
+
+static InstantClock instantClock;
+static MockSerial mockSerial;
+static MockI2C mockI2C;
+
+// Input layout:
+//   0: bits 0-1 transport (0 compact, 1 Pololu, 2 I2C, 3 TicT fast path),
+//      bit 2 command CRC, bit 3 response CRC, bit 4 read instead of command,
+//      bits 5-7 product
+//   1: device number or I2C address
+//   2: command index, or read type
+//   3-6: 32-bit value (little-endian)
+//   7: read offset
+//   8: read length
+//   9...: memory contents for reads
+static void checkInput(const uint8_t * data, size_t size)
+{
+  currentInput = data;
+  currentInputSize = size;
+  hostSetClock(&instantClock);
+
+  uint8_t in[9];
+  memset(in, 0, sizeof(in));
+  memcpy(in, data, size < sizeof(in) ? size : sizeof(in));
+
+  uint8_t transport = in[0] & 3;
+  bool crcForCommands = in[0] >> 2 & 1;
+  bool crcForResponses = in[0] >> 3 & 1;
+  bool isRead = in[0] >> 4 & 1;
+  TicProduct product = products[(in[0] >> 5) % 5];
+  uint8_t device = in[1] & 0x7F;
+  uint32_t val = (uint32_t)in[3] | (uint32_t)in[4] << 8 |
+    (uint32_t)in[5] << 16 | (uint32_t)in[6] << 24;
+
+  for (uint16_t i = 0; i < 256; i++)
+  {
+    uint8_t b = 9 + (size_t)i < size ? data[9 + i] : (uint8_t)(i * 37 + 11);
+    mockSerial.memory[i] = mockI2C.memory[i] = b;
+  }
+
+  mockSerial.reset();
+  mockSerial.crcForCommands = crcForCommands;
+  mockSerial.crcForResponses = crcForResponses;
+  mockI2C.frames.clear();
+  Wire.setBackend(&mockI2C);
+
+  TicSerial serial(mockSerial, transport == 1 ? device : 255);
+  serial.setCrcForCommands(crcForCommands);
+  serial.setCrcForResponses(crcForResponses);
+  TicI2C i2c(device);
+  bool useI2C = transport == 2;
+  TicBase & tic = useI2C ? (TicBase &)i2c : (TicBase &)serial;
+  tic.setProduct(product);
+  std::vector<Decoded> & frames = useI2C ? mockI2C.frames : mockSerial.frames;
+  uint8_t expectedDevice = useI2C ? device : transport == 1 ? device : 255;
+
+  if (isRead)
+  {
+    static const TicCommand reads[] = { TicCommand::GetVariable,
+      TicCommand::GetVariableAndClearErrorsOccurred, TicCommand::GetSetting };
+    TicCommand cmd = reads[in[2] % 3];
+    uint8_t offset = in[7];
+    uint8_t length = in[8] % (256 - offset + 1);
+    uint8_t buffer[256];
+    memset(buffer, 0xCC, sizeof(buffer));
+
+    tic.readBlock(cmd, offset, length, buffer);
+    check(tic.getLastError() == 0, "read succeeds");
+    check(memcmp(buffer, mockSerial.memory + offset, length) == 0,
+      "read returns the device's bytes");
+
+    // The requests must cover the block in order with no gaps.
+    uint16_t next = offset;
+    for (const Decoded & f : frames)
+    {
+      check(f.cmd == (uint8_t)cmd, "read command");
+      check(f.device == expectedDevice, "read device");
+      check(f.offset == next, "read requests are contiguous");
+      check(f.length >= 1 && f.length <= TicMaxSegmentLength,
+        "read request length");
+      next += f.length;
+    }
+    check(next == offset + length, "read requests cover the block");
+    return;
+  }
+
+  TicCommand cmd = writeCommands[in[2] % (sizeof(writeCommands) /
+    sizeof(writeCommands[0]))];
+  uint32_t expected = val;
+  switch (dataLengthOf((uint8_t)cmd))
+  {
+  case 0: expected = 0; break;
+  case 1: expected = val & 0x7F; break;
+  }
+
+  if (transport == 3)
+  {
+    // The non-virtual setters of TicT.
+    switch (in[2] % 5)
+    {
+    case 0: cmd = TicCommand::SetTargetPosition; serial.setTargetPosition(val); break;
+    case 1: cmd = TicCommand::SetTargetVelocity; serial.setTargetVelocity(val); break;
+    case 2: cmd = TicCommand::HaltAndSetPosition; serial.haltAndSetPosition(val); break;
+    case 3: cmd = TicCommand::HaltAndHold; serial.haltAndHold(); break;
+    case 4: cmd = TicCommand::ResetCommandTimeout; serial.resetCommandTimeout(); break;
+    }
+    expected = dataLengthOf((uint8_t)cmd) ? val : 0;
+  }
+  else
+  {
+    tic.sendCommand(cmd, val);
+  }
+
+  check(frames.size() == 1, "one command is sent");
+  check(frames[0].cmd == (uint8_t)cmd, "command byte");
+  check(frames[0].device == expectedDevice, "device number");
+  check(frames[0].val == expected, "command value");
+
+  if (!useI2C)
+  {
+    // The compile-time encoder must produce the same bytes.
+    uint8_t dev = transport == 1 ? device : 255;
+    TicFrame frame;
+    switch (dataLengthOf((uint8_t)cmd))
+    {
+    case 0: frame = TicFrameBuilder::quick(cmd, dev, crcForCommands); break;
+    case 1: frame = TicFrameBuilder::w7(cmd, val, dev, crcForCommands); break;
+    default: frame = TicFrameBuilder::w32(cmd, val, dev, crcForCommands); break;
+    }
+    check(frame.length == mockSerial.written.size() &&
+      memcmp(frame.data, mockSerial.written.data(), frame.length) == 0,
+      "TicFrameBuilder matches TicSerial");
+  }
+
+  // Current limits: the code sent is the reference conversion, and reading
+  // it back gives the current for that code.
+  uint16_t mA = val;
+  frames.clear();
+  mockSerial.reset();
+  tic.setCurrentLimit(mA);
+  uint8_t code = toCode(product, mA);
+  check(frames.size() == 1 && frames[0].val == code, "current limit code");
+  check(fromCode(product, code) <= mA, "current limit is at most the request");
+  mockSerial.memory[0x4A] = mockI2C.memory[0x4A] = code;
+  check(tic.getCurrentLimit() == fromCode(product, code),
+    "getCurrentLimit() decodes the code");
+}
+
+#ifdef TIC_FUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size)
+{
+  checkInput(data, size);
+  return 0;
+}
+
+#else
+
+static uint32_t xorshift(uint32_t & state)
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+int main(int argc, char ** argv)
+{
+  uint32_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 0) : 200000;
+  uint32_t seed = argc > 2 ? strtoul(argv[2], nullptr, 0) : 1;
+  if (seed == 0) { seed = 1; }
+
+  // Every current limit for every product, through each transport.
+  uint32_t count = 0;
+  for (uint8_t p = 0; p < 5; p++)
+  {
+    for (uint32_t mA = 0; mA <= 0xFFFF; mA++)
+    {
+      uint8_t input[9] = { (uint8_t)(p << 5 | (mA % 3)), 14,
+        (uint8_t)TicCommand::SetCurrentLimit, (uint8_t)mA, (uint8_t)(mA >> 8) };
+      checkInput(input, sizeof(input));
+      count++;
+    }
+  }
+
+  // Random inputs.
+  uint32_t state = seed;
+  uint8_t input[9 + 256];
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    size_t size = xorshift(state) % sizeof(input);
+    for (size_t j = 0; j < size; j++) { input[j] = xorshift(state); }
+    checkInput(input, size);
+    count++;
+  }
+
+  printf("%lu inputs passed\n", (unsigned long)count);
+  return 0;
+}
+
+#endif
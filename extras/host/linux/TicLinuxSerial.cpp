@@ -0,0 +1,199 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+#include "TicLinuxSerial.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#include <sys/ioctl.h>
+#endif
+
+static bool speedFor(uint32_t baudRate, speed_t & speed)
+{
+  switch (baudRate)
+  {
+  case 1200: speed = B1200; return true;
+  case 2400: speed = B2400; return true;
+  case 4800: speed = B4800; return true;
+  case 9600: speed = B9600; return true;
+  case 19200: speed = B19200; return true;
+  case 38400: speed = B38400; return true;
+  case 57600: speed = B57600; return true;
+  case 115200: speed = B115200; return true;
+  case 230400: speed = B230400; return true;
+#ifdef B460800
+  case 460800: speed = B460800; return true;
+#endif
+#ifdef B500000
+  case 500000: speed = B500000; return true;
+#endif
+  default: return false;
+  }
+}
+
+// Returns the time in milliseconds from the kernel's monotonic clock.  This
+// is used for poll() timeouts instead of millis(), which may be running in
+// virtual time.
+static uint64_t monotonicMillis()
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t)time.tv_sec * 1000 + time.tv_nsec / 1000000;
+}
+
+bool TicLinuxSerial::open(const char * path, uint32_t baudRate)
+{
+  int newFd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (newFd < 0) { return false; }
+  return attach(newFd, baudRate);
+}
+
+bool TicLinuxSerial::attach(int newFd, uint32_t baudRate)
+{
+  close();
+
+  speed_t speed;
+  struct termios options;
+  if (!speedFor(baudRate, speed))
+  {
+    ::close(newFd);
+    errno = EINVAL;
+    return false;
+  }
+  if (tcgetattr(newFd, &options) < 0)
+  {
+    int error = errno;
+    ::close(newFd);
+    errno = error;
+    return false;
+  }
+
+  cfmakeraw(&options);
+  options.c_cflag |= CLOCAL | CREAD;
+  options.c_cflag &= ~(CSTOPB | CRTSCTS);
+  options.c_cc[VMIN] = 0;
+  options.c_cc[VTIME] = 0;
+  cfsetispeed(&options, speed);
+  cfsetospeed(&options, speed);
+
+  if (tcsetattr(newFd, TCSANOW, &options) < 0 ||
+    fcntl(newFd, F_SETFL, fcntl(newFd, F_GETFL) | O_NONBLOCK) < 0)
+  {
+    int error = errno;
+    ::close(newFd);
+    errno = error;
+    return false;
+  }
+
+#ifdef __linux__
+  // Ask the driver to pass received bytes on right away.  Many drivers,
+  // including pseudo-terminals, do not support this, which is fine.
+  struct serial_struct serial;
+  if (ioctl(newFd, TIOCGSERIAL, &serial) == 0)
+  {
+    serial.flags |= ASYNC_LOW_LATENCY;
+    ioctl(newFd, TIOCSSERIAL, &serial);
+  }
+#endif
+
+  // Discard anything received before the port was configured.
+  tcflush(newFd, TCIOFLUSH);
+
+  fd = newFd;
+  rxStart = rxEnd = 0;
+  return true;
+}
+
+void TicLinuxSerial::close()
+{
+  if (fd >= 0)
+  {
+    ::close(fd);
+    fd = -1;
+  }
+  rxStart = rxEnd = 0;
+}
+
+size_t TicLinuxSerial::write(const uint8_t * buffer, size_t length)
+{
+  size_t written = 0;
+  while (fd >= 0 && written < length)
+  {
+    ssize_t result = ::write(fd, buffer + written, length - written);
+    if (result > 0)
+    {
+      written += result;
+    }
+    else if (result < 0 && errno == EAGAIN)
+    {
+      // The kernel's buffer is full.  Wait for room, but give up after the
+      // timeout rather than hang on a stuck port.
+      struct pollfd p = { fd, POLLOUT, 0 };
+      if (poll(&p, 1, getTimeout()) <= 0) { break; }
+    }
+    else if (!(result < 0 && errno == EINTR))
+    {
+      break;
+    }
+  }
+  return written;
+}
+
+// Reads whatever is available into the receive buffer, waiting up to the
+// specified number of milliseconds of real time for the first byte.  Returns
+// true if the buffer is not empty.
+bool TicLinuxSerial::fill(unsigned long timeout)
+{
+  if (rxStart < rxEnd) { return true; }
+  if (fd < 0) { return false; }
+  rxStart = rxEnd = 0;
+
+  uint64_t deadline = monotonicMillis() + timeout;
+  while (true)
+  {
+    ssize_t result = ::read(fd, rx, sizeof(rx));
+    if (result > 0)
+    {
+      rxEnd = result;
+      return true;
+    }
+    if (result < 0 && errno == EINTR) { continue; }
+    if (result < 0 && errno != EAGAIN) { return false; }
+
+    // Nothing yet: wait with poll() for the rest of the time.
+    uint64_t now = monotonicMillis();
+    if (now >= deadline) { return false; }
+    struct pollfd p = { fd, POLLIN, 0 };
+    int ready = poll(&p, 1, (int)(deadline - now));
+    if (ready < 0 && errno != EINTR) { return false; }
+    if (ready == 0) { return false; }
+    if (ready > 0 && !(p.revents & POLLIN)) { return false; }
+  }
+}
+
+int TicLinuxSerial::available()
+{
+  fill(0);
+  return rxEnd - rxStart;
+}
+
+int TicLinuxSerial::read()
+{
+  if (!fill(0)) { return -1; }
+  return rx[rxStart++];
+}
+
+int TicLinuxSerial::peek()
+{
+  if (!fill(0)) { return -1; }
+  return rx[rxStart];
+}
+
+void TicLinuxSerial::flush()
+{
+  if (fd >= 0) { tcdrain(fd); }
+}
@@ -0,0 +1,76 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+#pragma once
+
+#include <Arduino.h>
+
+/// A serial port on Linux (or another POSIX system) that TicSerial can use
+/// in place of an Arduino serial port, for example a Tic's USB virtual serial
+/// port (/dev/ttyACM0) or a UART on a single-board computer.
+///
+/// Example usage:
+/// ```
+/// TicLinuxSerial port;
+/// if (!port.open("/dev/ttyACM0", 115200)) { perror("open"); }
+/// TicSerial tic(port);
+/// tic.exitSafeStart();
+/// ```
+///
+/// The port is put in raw mode with VMIN and VTIME set to 0, so reads never
+/// block in the kernel; waiting is done with poll() instead.  On Linux, the
+/// low-latency flag is also set if the driver supports it.
+///
+/// Each call to `write(buffer, length)` is a single write() system call (or
+/// more only if the kernel accepts part of the data), so each command frame
+/// from TicSerial goes out in one piece.
+///
+/// available(), peek(), and read() never wait, like an Arduino serial port:
+/// read() returns -1 if no byte has been received, and the waiting for a
+/// response is done by Stream::readBytes().  To wait for input without busy
+/// polling, call waitForInput(), which sleeps in poll().
+class TicLinuxSerial : public Stream
+{
+public:
+  TicLinuxSerial() {}
+  ~TicLinuxSerial() { close(); }
+
+  TicLinuxSerial(const TicLinuxSerial &) = delete;
+  TicLinuxSerial & operator=(const TicLinuxSerial &) = delete;
+
+  /// Opens and configures the specified serial port.  Returns false and
+  /// leaves `errno` set if it fails, including if the baud rate is not
+  /// supported.
+  bool open(const char * path, uint32_t baudRate);
+
+  /// Configures and uses a file descriptor that is already open, such as the
+  /// slave side of a pseudo-terminal.  The object takes ownership of the file
+  /// descriptor and closes it in close().
+  bool attach(int fd, uint32_t baudRate);
+
+  /// Closes the port.
+  void close();
+
+  /// Returns the file descriptor, or -1 if the port is not open.
+  int getFd() { return fd; }
+
+  size_t write(uint8_t byte) override { return write(&byte, 1); }
+  size_t write(const uint8_t * buffer, size_t length) override;
+  int available() override;
+  int read() override;
+  int peek() override;
+
+  /// Waits until everything written has been transmitted.
+  void flush() override;
+
+  /// Waits up to `timeout` milliseconds of real time for input.  Returns
+  /// true if at least one byte is available.
+  bool waitForInput(unsigned long timeout) { return fill(timeout); }
+
+private:
+  bool fill(unsigned long timeout);
+
+  int fd = -1;
+  uint8_t rx[256];
+  uint16_t rxStart = 0;
+  uint16_t rxEnd = 0;
+};
@@ -0,0 +1,153 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+// Runs TicSerial over TicLinuxSerial against a simulated Tic on the other
+// end of a pseudo-terminal, in real time, and checks that commands and reads
+// work in the compact and Pololu protocols, with and without CRC, and that a
+// Tic that does not answer times out.  It needs no hardware, so it can run
+// in CI.  It prints what it checked and exits with a non-zero status if
+// anything failed.
+//
+// Usage: tic_pty_check [baud rate]
+
+#include "TicLinuxSerial.h"
+#include <TicSim.h>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <unistd.h>
+
+static int failures = 0;
+
+static void check(bool condition, const char * what)
+{
+  printf("%s: %s\n", condition ? "ok" : "FAILED", what);
+  if (!condition) { failures++; }
+}
+
+// Runs the simulated Tic on the master side of the pseudo-terminal until
+// `stop` is set.
+static void runDevice(int master, TicSimDevice & device,
+  std::atomic<bool> & stop)
+{
+  while (!stop)
+  {
+    struct pollfd p = { master, POLLIN, 0 };
+    if (poll(&p, 1, 10) <= 0) { continue; }
+
+    uint8_t bytes[64];
+    ssize_t count = read(master, bytes, sizeof(bytes));
+    if (count <= 0) { continue; }
+
+    device.update(micros());
+    std::vector<uint8_t> response;
+    for (ssize_t i = 0; i < count; i++)
+    {
+      device.receiveSerialByte(bytes[i], response);
+    }
+    if (response.size())
+    {
+      ssize_t written = write(master, response.data(), response.size());
+      (void)written;
+    }
+  }
+}
+
+static void checkTic(TicSerial & tic, const char * name)
+{
+  char what[80];
+
+  tic.exitSafeStart();
+  tic.setTargetVelocity(-2000000);
+  tic.setMaxAccel(100000);
+  snprintf(what, sizeof(what), "%s: target velocity reads back", name);
+  check(tic.getTargetVelocity() == -2000000 && tic.getLastError() == 0, what);
+
+  snprintf(what, sizeof(what), "%s: max acceleration reads back", name);
+  check(tic.getMaxAccel() == 100000, what);
+
+  TicVariables vars;
+  tic.getVariables(vars);
+  snprintf(what, sizeof(what), "%s: getVariables()", name);
+  check(tic.getLastError() == 0 && vars.vinVoltage == 12000 &&
+    vars.planningMode == TicPlanningMode::TargetVelocity, what);
+
+  tic.haltAndSetPosition(12345);
+  snprintf(what, sizeof(what), "%s: haltAndSetPosition()", name);
+  check(tic.getCurrentPosition() == 12345 && !tic.getPositionUncertain(),
+    what);
+}
+
+int main(int argc, char ** argv)
+{
+  uint32_t baudRate = argc > 1 ? atol(argv[1]) : 115200;
+
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+  {
+    perror("posix_openpt");
+    return 1;
+  }
+
+  TicLinuxSerial port;
+  if (!port.open(ptsname(master), baudRate))
+  {
+    perror(ptsname(master));
+    return 1;
+  }
+  port.setTimeout(100);
+
+  TicSimDevice device(14);
+  device.setCommandTimeout(0);
+  device.update(micros());
+  std::atomic<bool> stop(false);
+  std::thread deviceThread(runDevice, master, std::ref(device), std::ref(stop));
+
+  TicSerial compact(port);
+  checkTic(compact, "compact");
+
+  TicSerial pololu(port, 14);
+  checkTic(pololu, "Pololu");
+
+  // Stop the device thread while changing the device's settings.
+  stop = true;
+  deviceThread.join();
+  device.setCrc(true, true);
+  stop = false;
+  deviceThread = std::thread(runDevice, master, std::ref(device),
+    std::ref(stop));
+
+  TicSerial crc(port, 14);
+  crc.setCrcForCommands(true);
+  crc.setCrcForResponses(true);
+  checkTic(crc, "Pololu with CRC");
+
+  TicSerial absent(port, 40);
+  unsigned long start = millis();
+  absent.getUpTime();
+  unsigned long elapsed = millis() - start;
+  check(absent.getLastError() == 50 && elapsed >= 100 && elapsed < 1000,
+    "a missing Tic times out");
+
+  // Like an Arduino serial port, read() must not wait for input.
+  start = millis();
+  int byte = port.read();
+  elapsed = millis() - start;
+  check(byte == -1 && elapsed < 50, "read() returns -1 without waiting");
+
+  start = millis();
+  bool input = port.waitForInput(100);
+  elapsed = millis() - start;
+  check(!input && elapsed >= 100 && elapsed < 1000,
+    "waitForInput() waits for the timeout");
+
+  stop = true;
+  deviceThread.join();
+  close(master);
+
+  printf(failures ? "%d checks failed\n" : "all checks passed\n", failures);
+  return failures ? 1 : 0;
+}
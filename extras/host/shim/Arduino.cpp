@@ -0,0 +1,70 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+#include <Arduino.h>
+#include <chrono>
+#include <thread>
+
+namespace
+{
+  class SteadyClock : public HostClock
+  {
+  public:
+    uint64_t now() override
+    {
+      return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    }
+
+    void waitUntil(uint64_t time) override
+    {
+      uint64_t current = now();
+      if (time > current)
+      {
+        std::this_thread::sleep_for(
+          std::chrono::microseconds(time - current));
+      }
+    }
+
+  private:
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  };
+
+  SteadyClock steadyClock;
+  HostClock * currentClock = &steadyClock;
+}
+
+void hostSetClock(HostClock * clock)
+{
+  currentClock = clock ? clock : &steadyClock;
+}
+
+HostClock * hostGetClock()
+{
+  return currentClock;
+}
+
+unsigned long millis()
+{
+  return currentClock->now() / 1000;
+}
+
+unsigned long micros()
+{
+  return currentClock->now();
+}
+
+void delay(unsigned long ms)
+{
+  currentClock->waitUntil(currentClock->now() + (uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  currentClock->waitUntil(currentClock->now() + us);
+}
+
+void yield()
+{
+  currentClock->idle();
+}
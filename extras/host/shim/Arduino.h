@@ -0,0 +1,52 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+// A minimal stand-in for the Arduino core, so the library can be compiled
+// and run on a host computer.  Only what the library uses is provided.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+#define memcpy_P(dest, src, length) memcpy((dest), (src), (length))
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+/// The source of time for millis(), micros(), delay(), and yield().  The
+/// default clock uses the host's monotonic clock.  A simulation can install
+/// its own clock with hostSetClock() to run in virtual time.
+class HostClock
+{
+public:
+  virtual ~HostClock() {}
+
+  /// Returns the time in microseconds.
+  virtual uint64_t now() = 0;
+
+  /// Waits until the specified time.
+  virtual void waitUntil(uint64_t time) = 0;
+
+  /// Called by yield(), which is called while the library waits for input.
+  virtual void idle() {}
+};
+
+/// Makes the time functions use the specified clock.  Pass `nullptr` to go
+/// back to the host's monotonic clock.
+void hostSetClock(HostClock * clock);
+
+/// Returns the clock being used.
+HostClock * hostGetClock();
+
+#include "Print.h"
+#include "Stream.h"
@@ -0,0 +1,34 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Print
+{
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t byte) = 0;
+
+  virtual size_t write(const uint8_t * buffer, size_t size)
+  {
+    size_t n = 0;
+    while (size--)
+    {
+      if (write(*buffer++)) { n++; }
+      else { break; }
+    }
+    return n;
+  }
+
+  size_t write(const char * buffer, size_t size)
+  {
+    return write((const uint8_t *)buffer, size);
+  }
+
+  virtual int availableForWrite() { return 0; }
+
+  virtual void flush() {}
+};
@@ -0,0 +1,27 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+#include <Arduino.h>
+
+int Stream::timedRead()
+{
+  unsigned long start = millis();
+  do
+  {
+    int c = read();
+    if (c >= 0) { return c; }
+    yield();
+  } while (millis() - start < _timeout);
+  return -1;
+}
+
+size_t Stream::readBytes(uint8_t * buffer, size_t length)
+{
+  size_t count = 0;
+  while (count < length)
+  {
+    int c = timedRead();
+    if (c < 0) { break; }
+    buffer[count++] = c;
+  }
+  return count;
+}
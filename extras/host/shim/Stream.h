@@ -0,0 +1,33 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+#pragma once
+
+#include "Print.h"
+
+/// The base class for serial ports.  To connect the library to something,
+/// derive a class from this one; see the simulator in extras/host for an
+/// example.
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  /// Reads bytes until `length` bytes have been read or the timeout passes,
+  /// like the Arduino version.  Returns the number of bytes read.
+  size_t readBytes(uint8_t * buffer, size_t length);
+
+  size_t readBytes(char * buffer, size_t length)
+  {
+    return readBytes((uint8_t *)buffer, length);
+  }
+
+  void setTimeout(unsigned long timeout) { _timeout = timeout; }
+  unsigned long getTimeout() { return _timeout; }
+
+protected:
+  int timedRead();
+
+  unsigned long _timeout = 1000;
+};
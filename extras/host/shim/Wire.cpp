@@ -0,0 +1,65 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+#include <Wire.h>
+
+TwoWire Wire;
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+  _address = address;
+  _txLength = 0;
+  _txOverflow = false;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop)
+{
+  // Like the AVR Wire library, report data that did not fit in the buffer.
+  if (_txOverflow) { return 1; }
+  if (!_backend) { return 2; }
+  return _backend->write(_address, _txBuffer, _txLength, sendStop);
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity,
+  bool sendStop)
+{
+  if (quantity > BUFFER_LENGTH) { quantity = BUFFER_LENGTH; }
+  _rxIndex = 0;
+  _rxLength = _backend ?
+    _backend->read(address, _rxBuffer, quantity, sendStop) : 0;
+  return _rxLength;
+}
+
+size_t TwoWire::write(uint8_t byte)
+{
+  if (_txLength >= BUFFER_LENGTH)
+  {
+    _txOverflow = true;
+    return 0;
+  }
+  _txBuffer[_txLength++] = byte;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t * data, size_t length)
+{
+  size_t n = 0;
+  while (n < length && write(data[n])) { n++; }
+  return n;
+}
+
+int TwoWire::available()
+{
+  return _rxLength - _rxIndex;
+}
+
+int TwoWire::read()
+{
+  if (_rxIndex >= _rxLength) { return -1; }
+  return _rxBuffer[_rxIndex++];
+}
+
+int TwoWire::peek()
+{
+  if (_rxIndex >= _rxLength) { return -1; }
+  return _rxBuffer[_rxIndex];
+}
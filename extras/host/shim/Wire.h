@@ -0,0 +1,68 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+#pragma once
+
+#include <Arduino.h>
+
+#define BUFFER_LENGTH 32
+
+/// The devices on a host I2C bus.  Install one with TwoWire::setBackend().
+class TwoWireBackend
+{
+public:
+  virtual ~TwoWireBackend() {}
+
+  /// Handles a write transaction.  Returns a status code like
+  /// TwoWire::endTransmission(): 0 for success, 2 if the address was not
+  /// acknowledged, 3 if the data was not acknowledged, 4 for other errors.
+  virtual uint8_t write(uint8_t address, const uint8_t * data,
+    uint8_t length, bool sendStop) = 0;
+
+  /// Handles a read transaction.  Returns the number of bytes read, which is
+  /// 0 if the address was not acknowledged.
+  virtual uint8_t read(uint8_t address, uint8_t * data, uint8_t length,
+    bool sendStop) = 0;
+};
+
+/// A version of the Arduino Wire library's TwoWire class that passes
+/// transactions to a TwoWireBackend.  Without a backend, no device
+/// acknowledges.
+class TwoWire : public Stream
+{
+public:
+  void begin() {}
+  void end() {}
+  void setClock(uint32_t clock) { _clock = clock; }
+  uint32_t getClock() { return _clock; }
+
+  void setBackend(TwoWireBackend * backend) { _backend = backend; }
+  TwoWireBackend * getBackend() { return _backend; }
+
+  void beginTransmission(uint8_t address);
+  uint8_t endTransmission(bool sendStop = true);
+  uint8_t requestFrom(uint8_t address, uint8_t quantity,
+    bool sendStop = true);
+
+  size_t write(uint8_t byte) override;
+  size_t write(const uint8_t * data, size_t length) override;
+  using Print::write;
+
+  int available() override;
+  int read() override;
+  int peek() override;
+
+private:
+  TwoWireBackend * _backend = nullptr;
+  uint32_t _clock = 100000;
+
+  uint8_t _address = 0;
+  uint8_t _txBuffer[BUFFER_LENGTH];
+  uint8_t _txLength = 0;
+  bool _txOverflow = false;
+
+  uint8_t _rxBuffer[BUFFER_LENGTH];
+  uint8_t _rxLength = 0;
+  uint8_t _rxIndex = 0;
+};
+
+extern TwoWire Wire;
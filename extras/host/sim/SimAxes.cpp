@@ -0,0 +1,65 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+// Streams velocity commands to several simulated Tics on one serial bus and
+// reads back their positions, then reports how many updates per second the
+// bus can sustain.  Everything runs in virtual time, so the results do not
+// depend on the speed of the computer.
+//
+// Usage: tic_sim_axes [axes] [baud rate] [seconds]
+
+#include <TicSim.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory>
+
+int main(int argc, char ** argv)
+{
+  uint8_t axes = argc > 1 ? atoi(argv[1]) : 4;
+  uint32_t baudRate = argc > 2 ? atol(argv[2]) : 115200;
+  uint32_t seconds = argc > 3 ? atol(argv[3]) : 2;
+
+  TicSim sim;
+  TicSimSerialBus bus(sim, baudRate);
+
+  std::vector<std::unique_ptr<TicSimDevice>> devices;
+  std::vector<std::unique_ptr<TicSerial>> tics;
+  for (uint8_t i = 0; i < axes; i++)
+  {
+    devices.emplace_back(new TicSimDevice(i + 1));
+    bus.attach(*devices.back());
+    tics.emplace_back(new TicSerial(bus, i + 1));
+    tics.back()->exitSafeStart();
+  }
+
+  uint32_t updates = 0;
+  uint32_t errors = 0;
+  uint32_t start = millis();
+  while ((uint32_t)(millis() - start) < seconds * 1000)
+  {
+    // Sweep the target velocities back and forth once per second.
+    uint32_t t = millis() - start;
+    int32_t phase = t % 1000;
+    int32_t velocity = (phase < 500 ? phase : 1000 - phase) * 20000 - 5000000;
+
+    for (uint8_t i = 0; i < axes; i++)
+    {
+      tics[i]->setTargetVelocity(velocity);
+      tics[i]->getCurrentPosition();
+      if (tics[i]->getLastError()) { errors++; }
+    }
+    updates++;
+  }
+
+  double elapsed = (millis() - start) / 1000.0;
+  printf("axes\tbaud\tupdates_per_s\tbytes_written\tbytes_read\terrors\n");
+  printf("%u\t%lu\t%.1f\t%llu\t%llu\t%lu\n", axes, (unsigned long)baudRate,
+    updates / elapsed, (unsigned long long)bus.getBytesWritten(),
+    (unsigned long long)bus.getBytesRead(), (unsigned long)errors);
+
+  for (uint8_t i = 0; i < axes; i++)
+  {
+    printf("# axis %u: position %ld, velocity %ld\n", i + 1,
+      (long)devices[i]->getPosition(), (long)devices[i]->getVelocity());
+  }
+  return errors ? 1 : 0;
+}
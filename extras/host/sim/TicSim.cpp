@@ -0,0 +1,734 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+#include "TicSim.h"
+#include <algorithm>
+#include <math.h>
+
+static uint8_t crc7(const uint8_t * message, uint8_t length)
+{
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < length; i++)
+  {
+    crc ^= message[i];
+    for (uint8_t j = 0; j < 8; j++)
+    {
+      if (crc & 1) { crc ^= 0x91; }
+      crc >>= 1;
+    }
+  }
+  return crc;
+}
+
+static void write16(uint8_t * buffer, uint16_t value)
+{
+  buffer[0] = value >> 0;
+  buffer[1] = value >> 8;
+}
+
+static void write32(uint8_t * buffer, uint32_t value)
+{
+  write16(buffer, value);
+  write16(buffer + 2, value >> 16);
+}
+
+// Returns the number of data bytes that follow a command in the serial
+// protocol, or 0xFF if the command is not valid.
+static uint8_t serialDataLength(uint8_t cmd)
+{
+  switch (cmd & 0xF0)
+  {
+  case 0x80: return 0;
+  case 0x90: return 1;
+  case 0xA0: return 2;
+  case 0xB0: return 0;
+  case 0xE0: return 5;
+  default: return 0xFF;
+  }
+}
+
+static uint16_t bit(TicError error)
+{
+  return 1 << (uint8_t)error;
+}
+
+/**** TicSimDevice ****/
+
+TicSimDevice::TicSimDevice(uint8_t deviceNumber, TicProduct product)
+  : deviceNumber(deviceNumber), product(product)
+{
+  powerUp();
+}
+
+void TicSimDevice::setCrc(bool forCommands, bool forResponses)
+{
+  crcForCommands = forCommands;
+  crcForResponses = forResponses;
+}
+
+void TicSimDevice::powerUp()
+{
+  upTimeStart = time;
+  errorsOccurred = 0;
+  processCommand((uint8_t)TicCommand::Reset, nullptr, false, nullptr);
+}
+
+void TicSimDevice::setError(TicError error)
+{
+  uint32_t mask = (uint32_t)1 << (uint8_t)error;
+  errorsOccurred |= mask;
+  if ((uint8_t)error >= 16) { return; }  // only reported in errorsOccurred
+
+  errorStatus |= mask;
+  planningMode = TicPlanningMode::Off;
+  if (error == TicError::IntentionallyDeenergized)
+  {
+    velocity = 0;
+    positionUncertain = true;
+  }
+  if (error != TicError::SafeStartViolation && !disableSafeStart)
+  {
+    setError(TicError::SafeStartViolation);
+  }
+}
+
+void TicSimDevice::clearError(TicError error)
+{
+  errorStatus &= ~bit(error);
+}
+
+void TicSimDevice::setTargetPosition(int32_t position)
+{
+  if (errorStatus) { return; }
+  planningMode = TicPlanningMode::TargetPosition;
+  targetPosition = position;
+}
+
+void TicSimDevice::setTargetVelocity(int32_t velocity)
+{
+  if (errorStatus) { return; }
+  planningMode = TicPlanningMode::TargetVelocity;
+  targetVelocity = velocity;
+}
+
+void TicSimDevice::halt()
+{
+  velocity = 0;
+  planningMode = TicPlanningMode::Off;
+}
+
+void TicSimDevice::processCommand(uint8_t cmd, const uint8_t * data,
+  bool serial, std::vector<uint8_t> * response)
+{
+  uint32_t val = 0;
+  if (data)
+  {
+    switch (serialDataLength(cmd))
+    {
+    case 1:
+      val = data[0] & 0x7F;
+      break;
+    case 5:
+      if (serial)
+      {
+        val = (uint32_t)(data[1] | (data[0] << 7 & 0x80)) |
+          (uint32_t)(data[2] | (data[0] << 6 & 0x80)) << 8 |
+          (uint32_t)(data[3] | (data[0] << 5 & 0x80)) << 16 |
+          (uint32_t)(data[4] | (data[0] << 4 & 0x80)) << 24;
+      }
+      else
+      {
+        val = (uint32_t)data[0] | (uint32_t)data[1] << 8 |
+          (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+      }
+      break;
+    }
+  }
+
+  commandCount++;
+  lastCommandTime = time;
+  clearError(TicError::CommandTimeout);
+
+  switch ((TicCommand)cmd)
+  {
+  case TicCommand::SetTargetPosition:
+    setTargetPosition(val);
+    break;
+  case TicCommand::SetTargetVelocity:
+    setTargetVelocity(val);
+    break;
+  case TicCommand::HaltAndSetPosition:
+    halt();
+    position = (int32_t)val;
+    positionUncertain = false;
+    break;
+  case TicCommand::HaltAndHold:
+    halt();
+    positionUncertain = true;
+    break;
+  case TicCommand::GoHome:
+    // Homing needs limit switches, which are not simulated.
+    break;
+  case TicCommand::ResetCommandTimeout:
+    break;
+  case TicCommand::Deenergize:
+    setError(TicError::IntentionallyDeenergized);
+    break;
+  case TicCommand::Energize:
+    clearError(TicError::IntentionallyDeenergized);
+    break;
+  case TicCommand::ExitSafeStart:
+    clearError(TicError::SafeStartViolation);
+    break;
+  case TicCommand::EnterSafeStart:
+    if (!disableSafeStart) { setError(TicError::SafeStartViolation); }
+    break;
+  case TicCommand::Reset:
+    errorStatus = 0;
+    halt();
+    position = 0;
+    positionUncertain = true;
+    targetPosition = targetVelocity = 0;
+    startingSpeed = settingStartingSpeed;
+    maxSpeed = settingMaxSpeed;
+    maxAccel = settingMaxAccel;
+    maxDecel = settingMaxDecel;
+    stepMode = settingStepMode;
+    currentLimit = settingCurrentLimit;
+    decayMode = settingDecayMode;
+    memset(agc, 0, sizeof(agc));
+    if (!disableSafeStart) { setError(TicError::SafeStartViolation); }
+    break;
+  case TicCommand::ClearDriverError:
+    clearError(TicError::MotorDriverError);
+    break;
+  case TicCommand::SetSpeedMax:
+    maxSpeed = val;
+    break;
+  case TicCommand::SetStartingSpeed:
+    startingSpeed = val;
+    break;
+  case TicCommand::SetAccelMax:
+    maxAccel = val;
+    break;
+  case TicCommand::SetDecelMax:
+    maxDecel = val;
+    break;
+  case TicCommand::SetStepMode:
+    stepMode = val;
+    break;
+  case TicCommand::SetCurrentLimit:
+    currentLimit = val;
+    break;
+  case TicCommand::SetDecayMode:
+    decayMode = val;
+    break;
+  case TicCommand::SetAgcOption:
+    agc[val >> 4 & 3] = val & 0xF;
+    break;
+  case TicCommand::GetVariable:
+  case TicCommand::GetVariableAndClearErrorsOccurred:
+  case TicCommand::GetSetting:
+    if (serial && response)
+    {
+      uint8_t offset = data[0] | (data[1] & 0x40) << 1;
+      uint8_t length = data[1] & 0x3F;
+      if (length > TicMaxSegmentLength)
+      {
+        setError(TicError::Format);
+        break;
+      }
+      size_t start = response->size();
+      for (uint8_t i = 0; i < length; i++)
+      {
+        response->push_back(readByte(cmd, offset + i));
+      }
+      if (crcForResponses)
+      {
+        response->push_back(crc7(response->data() + start, length));
+      }
+      if ((TicCommand)cmd == TicCommand::GetVariableAndClearErrorsOccurred)
+      {
+        errorsOccurred = 0;
+      }
+    }
+    else if (!serial)
+    {
+      i2cReadCmd = cmd;
+      i2cReadOffset = data[0];
+    }
+    break;
+  default:
+    commandCount--;
+    break;
+  }
+}
+
+uint8_t TicSimDevice::readByte(uint8_t cmd, uint8_t offset)
+{
+  if ((TicCommand)cmd == TicCommand::GetSetting)
+  {
+    return getSetting(offset);
+  }
+  uint8_t vars[256];
+  getVariables(vars, sizeof(vars));
+  return vars[offset];
+}
+
+void TicSimDevice::getVariables(uint8_t * vars, size_t size)
+{
+  uint8_t buffer[256];
+  memset(buffer, 0, sizeof(buffer));
+
+  bool energized = !(errorStatus & bit(TicError::IntentionallyDeenergized));
+  TicOperationState state = TicOperationState::Normal;
+  if (!energized) { state = TicOperationState::Deenergized; }
+  else if (errorStatus) { state = TicOperationState::SoftError; }
+
+  buffer[0x00] = (uint8_t)state;
+  buffer[0x01] = energized << (uint8_t)TicMiscFlags1::Energized |
+    positionUncertain << (uint8_t)TicMiscFlags1::PositionUncertain;
+  write16(buffer + 0x02, errorStatus);
+  write32(buffer + 0x04, errorsOccurred);
+  buffer[0x09] = (uint8_t)planningMode;
+  write32(buffer + 0x0A, targetPosition);
+  write32(buffer + 0x0E, targetVelocity);
+  write32(buffer + 0x12, startingSpeed);
+  write32(buffer + 0x16, maxSpeed);
+  write32(buffer + 0x1A, maxDecel ? maxDecel : maxAccel);
+  write32(buffer + 0x1E, maxAccel);
+  write32(buffer + 0x22, getPosition());
+  write32(buffer + 0x26, getVelocity());
+  write32(buffer + 0x2A,
+    planningMode == TicPlanningMode::TargetPosition ?
+    targetPosition : getPosition());
+  write32(buffer + 0x2E, velocity ? (time - lastStepTime) * 3 : 0);
+  buffer[0x32] = (uint8_t)TicReset::PowerUp;
+  write16(buffer + 0x33, 12000);
+  write32(buffer + 0x35, (time - upTimeStart) / 1000);
+  write16(buffer + 0x3D, TicInputNull);
+  buffer[0x49] = stepMode;
+  buffer[0x4A] = currentLimit;
+  buffer[0x4B] = decayMode;
+  write16(buffer + 0x4D, TicInputNull);
+  write16(buffer + 0x4F, TicInputNull);
+  write16(buffer + 0x51, TicInputNull);
+  memcpy(buffer + 0x56, agc, sizeof(agc));
+
+  memcpy(vars, buffer, std::min(size, sizeof(buffer)));
+}
+
+uint8_t TicSimDevice::getSetting(uint8_t offset)
+{
+  uint8_t buffer[256];
+  memset(buffer, 0, sizeof(buffer));
+
+  buffer[0x01] = (uint8_t)TicControlMode::Serial;
+  buffer[0x03] = disableSafeStart;
+  buffer[0x07] = deviceNumber;
+  write16(buffer + 0x09, commandTimeout);
+  buffer[0x0B] = crcForCommands | crcForResponses << 1;
+  buffer[0x40] = settingCurrentLimit;
+  buffer[0x41] = settingStepMode;
+  buffer[0x42] = settingDecayMode;
+  write32(buffer + 0x43, settingStartingSpeed);
+  write32(buffer + 0x47, settingMaxSpeed);
+  write32(buffer + 0x4B, settingMaxDecel);
+  write32(buffer + 0x4F, settingMaxAccel);
+
+  return buffer[offset];
+}
+
+void TicSimDevice::update(uint64_t target)
+{
+  while (time < target)
+  {
+    uint64_t dt = std::min<uint64_t>(target - time, 1000);
+    time += dt;
+    step(dt / 1e6);
+
+    if (commandTimeout && !(errorStatus & bit(TicError::CommandTimeout)) &&
+      time - lastCommandTime > (uint64_t)commandTimeout * 1000)
+    {
+      setError(TicError::CommandTimeout);
+    }
+  }
+}
+
+// Velocities are in microsteps per 10,000 s, and accelerations are in
+// microsteps per 100 s^2, as on the Tic.
+void TicSimDevice::step(double dt)
+{
+  double accel = (maxAccel ? maxAccel : 1) * 100.0;
+  double decel = maxDecel ? maxDecel * 100.0 : accel;
+
+  double desired = 0;
+  if (planningMode == TicPlanningMode::TargetVelocity)
+  {
+    desired = std::max<double>(-(double)maxSpeed,
+      std::min<double>(maxSpeed, targetVelocity));
+  }
+  else if (planningMode == TicPlanningMode::TargetPosition)
+  {
+    double distance = targetPosition - position;
+    double stoppingDistance = velocity * velocity / (2 * decel * 10000);
+    if (distance * velocity > 0 && stoppingDistance >= fabs(distance))
+    {
+      desired = 0;
+    }
+    else if (distance != 0)
+    {
+      desired = distance > 0 ? maxSpeed : -(double)maxSpeed;
+    }
+  }
+
+  // Speeds up to the starting speed can be reached instantly.
+  bool speedingUp = fabs(desired) > fabs(velocity) && desired * velocity >= 0;
+  if (fabs(desired) <= startingSpeed && fabs(velocity) <= startingSpeed)
+  {
+    velocity = desired;
+  }
+  else if (speedingUp && fabs(velocity) < startingSpeed)
+  {
+    velocity = desired > 0 ? startingSpeed : -(double)startingSpeed;
+  }
+  else if (desired > velocity)
+  {
+    velocity = std::min(desired, velocity + (speedingUp ? accel : decel) * dt);
+  }
+  else if (desired < velocity)
+  {
+    velocity = std::max(desired, velocity - (speedingUp ? accel : decel) * dt);
+  }
+
+  double oldPosition = position;
+  position += velocity / 10000 * dt;
+
+  if (planningMode == TicPlanningMode::TargetPosition &&
+    (oldPosition - targetPosition) * (position - targetPosition) <= 0)
+  {
+    // Reached or passed the target.
+    position = targetPosition;
+    velocity = 0;
+  }
+
+  if (floor(position) != floor(oldPosition)) { lastStepTime = time; }
+}
+
+void TicSimDevice::receiveSerialByte(uint8_t byte,
+  std::vector<uint8_t> & response)
+{
+  if (byte == 0xAA || (byte & 0x80))
+  {
+    if (frameLength) { setError(TicError::Format); }
+    frame[0] = byte;
+    frameLength = 1;
+    if (byte == 0xAA) { return; }
+  }
+  else
+  {
+    if (frameLength == 0 || frameLength >= TicMaxFrameLength)
+    {
+      setError(TicError::Format);
+      frameLength = 0;
+      return;
+    }
+    frame[frameLength++] = byte;
+  }
+
+  bool pololu = frame[0] == 0xAA;
+  uint8_t headerLength = pololu ? 3 : 1;
+  if (frameLength < headerLength) { return; }
+
+  uint8_t cmd = pololu ? (frame[2] | 0x80) : frame[0];
+  uint8_t dataLength = serialDataLength(cmd);
+  if (dataLength == 0xFF)
+  {
+    setError(TicError::Format);
+    frameLength = 0;
+    return;
+  }
+
+  uint8_t length = headerLength + dataLength + crcForCommands;
+  if (frameLength < length) { return; }
+  frameLength = 0;
+
+  if (crcForCommands && crc7(frame, length - 1) != frame[length - 1])
+  {
+    setError(TicError::Crc);
+    return;
+  }
+
+  if (pololu && frame[1] != (deviceNumber & 0x7F)) { return; }
+
+  processCommand(cmd, frame + headerLength, true, &response);
+}
+
+bool TicSimDevice::receiveI2CWrite(const uint8_t * data, uint8_t length)
+{
+  if (length == 0) { return true; }
+
+  uint8_t cmd = data[0];
+  uint8_t dataLength = serialDataLength(cmd);
+  if (dataLength == 0xFF) { return false; }
+
+  // Over I2C, 32-bit values are sent as four plain bytes, and reads send
+  // only the offset.
+  if (dataLength == 5) { dataLength = 4; }
+  if (dataLength == 2) { dataLength = 1; }
+  if (length != 1 + dataLength) { return false; }
+
+  processCommand(cmd, data + 1, false, nullptr);
+  return true;
+}
+
+uint8_t TicSimDevice::receiveI2CRead(uint8_t * data, uint8_t length)
+{
+  for (uint8_t i = 0; i < length; i++)
+  {
+    data[i] = readByte(i2cReadCmd, i2cReadOffset + i);
+  }
+  if ((TicCommand)i2cReadCmd == TicCommand::GetVariableAndClearErrorsOccurred)
+  {
+    errorsOccurred = 0;
+  }
+  return length;
+}
+
+/**** TicSimSerialBus ****/
+
+TicSimSerialBus::TicSimSerialBus(TicSim & sim, uint32_t baudRate)
+  : sim(sim), baudRate(baudRate)
+{
+  sim.serialBuses.push_back(this);
+}
+
+TicSimSerialBus::~TicSimSerialBus()
+{
+  std::vector<TicSimSerialBus *> & buses = sim.serialBuses;
+  buses.erase(std::remove(buses.begin(), buses.end(), this), buses.end());
+}
+
+void TicSimSerialBus::attach(TicSimDevice & device)
+{
+  devices.push_back(&device);
+  sim.addDevice(&device);
+}
+
+size_t TicSimSerialBus::write(uint8_t byte)
+{
+  uint64_t now = sim.now();
+  uint64_t start = std::max(now, txFree);
+
+  // Block while the transmit buffer is full.
+  uint64_t bufferTime = txBufferSize * byteTime();
+  if (start - now > bufferTime) { sim.advanceTo(start - bufferTime); }
+
+  txFree = start + byteTime();
+  tx.push_back({ txFree, byte });
+  bytesWritten++;
+  return 1;
+}
+
+int TicSimSerialBus::arrivedCount()
+{
+  int count = 0;
+  for (const TimedByte & b : rx)
+  {
+    if (b.time > sim.now()) { break; }
+    count++;
+  }
+  return count;
+}
+
+int TicSimSerialBus::available()
+{
+  int count = arrivedCount();
+  if (count == 0)
+  {
+    sim.advanceTo(sim.now() + pollTime);
+    count = arrivedCount();
+  }
+  return count;
+}
+
+int TicSimSerialBus::read()
+{
+  if (rx.empty() || rx.front().time > sim.now()) { return -1; }
+  uint8_t byte = rx.front().byte;
+  rx.pop_front();
+  bytesRead++;
+  return byte;
+}
+
+int TicSimSerialBus::peek()
+{
+  if (rx.empty() || rx.front().time > sim.now()) { return -1; }
+  return rx.front().byte;
+}
+
+int TicSimSerialBus::availableForWrite()
+{
+  uint64_t now = sim.now();
+  uint64_t queued = txFree > now ?
+    (txFree - now + byteTime() - 1) / byteTime() : 0;
+  return queued >= txBufferSize ? 0 : txBufferSize - queued;
+}
+
+// Finds the time of the next byte to reach the Tics or the host.
+bool TicSimSerialBus::nextEventTime(uint64_t & time)
+{
+  bool found = false;
+  if (!tx.empty())
+  {
+    time = tx.front().time;
+    found = true;
+  }
+  for (const TimedByte & b : rx)
+  {
+    if (b.time <= sim.now()) { continue; }
+    if (!found || b.time < time) { time = b.time; }
+    found = true;
+    break;
+  }
+  return found;
+}
+
+// Delivers the bytes that reach the Tics by the specified time.
+void TicSimSerialBus::processEvents(uint64_t time)
+{
+  while (!tx.empty() && tx.front().time <= time)
+  {
+    TimedByte b = tx.front();
+    tx.pop_front();
+
+    std::vector<uint8_t> response;
+    for (TicSimDevice * device : devices)
+    {
+      device->update(b.time);
+      device->receiveSerialByte(b.byte, response);
+    }
+
+    uint64_t start = b.time + latency;
+    for (uint8_t byte : response)
+    {
+      start = std::max(start, rxFree);
+      rxFree = start + byteTime();
+      rx.push_back({ rxFree, byte });
+    }
+  }
+}
+
+/**** TicSimI2CBus ****/
+
+TicSimI2CBus::TicSimI2CBus(TicSim & sim, uint32_t clock)
+  : sim(sim), clock(clock)
+{
+}
+
+TicSimI2CBus::~TicSimI2CBus()
+{
+}
+
+void TicSimI2CBus::attach(TicSimDevice & device)
+{
+  devices.push_back(&device);
+  sim.addDevice(&device);
+}
+
+TicSimDevice * TicSimI2CBus::find(uint8_t address)
+{
+  for (TicSimDevice * device : devices)
+  {
+    if (device->getDeviceNumber() == address) { return device; }
+  }
+  return nullptr;
+}
+
+// Waits for a transaction: start, address byte, data bytes, and stop, with 9
+// clock cycles per byte.
+void TicSimI2CBus::transfer(uint8_t length)
+{
+  uint64_t bits = (1 + length) * 9 + 2;
+  sim.advanceTo(sim.now() + (bits * 1000000 + clock - 1) / clock);
+  transactions++;
+}
+
+uint8_t TicSimI2CBus::write(uint8_t address, const uint8_t * data,
+  uint8_t length, bool sendStop)
+{
+  (void)sendStop;
+  transfer(length);
+  TicSimDevice * device = find(address);
+  if (!device) { return 2; }
+  return device->receiveI2CWrite(data, length) ? 0 : 3;
+}
+
+uint8_t TicSimI2CBus::read(uint8_t address, uint8_t * data, uint8_t length,
+  bool sendStop)
+{
+  (void)sendStop;
+  transfer(length);
+  TicSimDevice * device = find(address);
+  if (!device) { return 0; }
+  return device->receiveI2CRead(data, length);
+}
+
+/**** TicSim ****/
+
+TicSim::TicSim()
+{
+  hostSetClock(this);
+}
+
+TicSim::~TicSim()
+{
+  if (hostGetClock() == this) { hostSetClock(nullptr); }
+}
+
+void TicSim::addDevice(TicSimDevice * device)
+{
+  if (std::find(devices.begin(), devices.end(), device) == devices.end())
+  {
+    device->update(time);
+    devices.push_back(device);
+  }
+}
+
+void TicSim::idle()
+{
+  uint64_t next = time + 100;
+  for (TicSimSerialBus * bus : serialBuses)
+  {
+    uint64_t busTime;
+    if (bus->nextEventTime(busTime) && busTime < next) { next = busTime; }
+  }
+  advanceTo(std::max(next, time + 1));
+}
+
+void TicSim::advanceTo(uint64_t target)
+{
+  while (true)
+  {
+    // Find the next byte to reach the Tics.
+    TicSimSerialBus * nextBus = nullptr;
+    uint64_t next = target;
+    for (TicSimSerialBus * bus : serialBuses)
+    {
+      if (!bus->tx.empty() && bus->tx.front().time <= next)
+      {
+        next = bus->tx.front().time;
+        nextBus = bus;
+      }
+    }
+    if (!nextBus) { break; }
+
+    if (next > time) { time = next; }
+    nextBus->processEvents(next);
+  }
+
+  if (target > time) { time = target; }
+  for (TicSimDevice * device : devices)
+  {
+    device->update(time);
+  }
+}
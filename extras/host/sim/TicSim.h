@@ -0,0 +1,281 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+// A behavioral simulator of Tic Stepper Motor Controllers, for running the
+// library on a host computer without hardware.
+//
+// TicSim keeps virtual time and installs itself as the HostClock, so
+// millis(), delay(), and the library's serial timeouts all run in virtual
+// time.  TicSimSerialBus is a Stream that carries bytes to and from any
+// number of TicSimDevice objects at a configurable baud rate, and
+// TicSimI2CBus does the same for I2C.
+//
+// Example:
+//
+//   TicSim sim;
+//   TicSimSerialBus bus(sim, 115200);
+//   TicSimDevice device(14);
+//   device.setCommandTimeout(0);
+//   bus.attach(device);
+//   TicSerial tic(bus, 14);
+//   tic.exitSafeStart();
+//   tic.setTargetPosition(1000);
+//   delay(2000);
+//   int32_t position = tic.getCurrentPosition();
+
+#pragma once
+
+#include <Tic.h>
+#include <Wire.h>
+#include <deque>
+#include <vector>
+
+class TicSim;
+
+/// One simulated Tic.  It parses serial and I2C commands the way a Tic does,
+/// keeps the variables that TicBase reads, and models the step planner:
+/// starting speed, max speed, acceleration and deceleration limits, position
+/// and velocity targets, halts, the command timeout, and safe start.
+///
+/// The model is simplified: there are no inputs, limit switches, homing, or
+/// motor driver errors, and the motion is integrated in steps of at most
+/// 1 ms.
+class TicSimDevice
+{
+public:
+  /// Creates a device with the specified serial device number, which is
+  /// also its I2C address.
+  TicSimDevice(uint8_t deviceNumber = 14,
+    TicProduct product = TicProduct::T825);
+
+  // Settings.  These take effect at power-up and after a Reset command; call
+  // powerUp() to apply them right away.
+  void setCrc(bool forCommands, bool forResponses);
+  void setCommandTimeout(uint16_t ms) { commandTimeout = ms; }
+  void setDisableSafeStart(bool disable) { disableSafeStart = disable; }
+  void setStartingSpeed(uint32_t speed) { settingStartingSpeed = speed; }
+  void setMaxSpeed(uint32_t speed) { settingMaxSpeed = speed; }
+  void setMaxAccel(uint32_t accel) { settingMaxAccel = accel; }
+  void setMaxDecel(uint32_t decel) { settingMaxDecel = decel; }
+
+  /// Simulates turning the power off and on.
+  void powerUp();
+
+  uint8_t getDeviceNumber() const { return deviceNumber; }
+  int32_t getPosition() const { return (int32_t)position; }
+  int32_t getVelocity() const { return (int32_t)velocity; }
+  uint16_t getErrorStatus() const { return errorStatus; }
+  TicPlanningMode getPlanningMode() const { return planningMode; }
+
+  /// Returns the number of commands and reads this device has accepted.
+  uint32_t getCommandCount() const { return commandCount; }
+
+  /// Fills `vars` with the device's variables, laid out as in the Tic's
+  /// "Get variable" command.
+  void getVariables(uint8_t * vars, size_t size);
+
+  /// Advances the motion model to the specified time in microseconds.
+  void update(uint64_t time);
+
+  /// Processes one byte from the serial bus and appends any response.
+  void receiveSerialByte(uint8_t byte, std::vector<uint8_t> & response);
+
+  /// Processes an I2C write.  Returns true if the data was a valid command.
+  bool receiveI2CWrite(const uint8_t * data, uint8_t length);
+
+  /// Processes an I2C read.  Returns the number of bytes provided.
+  uint8_t receiveI2CRead(uint8_t * data, uint8_t length);
+
+private:
+  static const uint8_t variablesSize = 0x5A;
+
+  void processCommand(uint8_t cmd, const uint8_t * data, bool serial,
+    std::vector<uint8_t> * response);
+  void setTargetPosition(int32_t position);
+  void setTargetVelocity(int32_t velocity);
+  void halt();
+  void setError(TicError error);
+  void clearError(TicError error);
+  uint8_t readByte(uint8_t cmd, uint8_t offset);
+  uint8_t getSetting(uint8_t offset);
+  void step(double dt);
+
+  uint8_t deviceNumber;
+  TicProduct product;
+
+  // Settings
+  bool crcForCommands = false;
+  bool crcForResponses = false;
+  uint16_t commandTimeout = 1000;
+  bool disableSafeStart = false;
+  uint32_t settingStartingSpeed = 0;
+  uint32_t settingMaxSpeed = 2000000;
+  uint32_t settingMaxAccel = 40000;
+  uint32_t settingMaxDecel = 0;
+  uint8_t settingStepMode = 0;
+  uint8_t settingCurrentLimit = 10;
+  uint8_t settingDecayMode = 0;
+
+  // State
+  uint64_t time = 0;
+  uint64_t upTimeStart = 0;
+  uint64_t lastCommandTime = 0;
+  uint16_t errorStatus = 0;
+  uint32_t errorsOccurred = 0;
+  bool positionUncertain = true;
+  TicPlanningMode planningMode = TicPlanningMode::Off;
+  int32_t targetPosition = 0;
+  int32_t targetVelocity = 0;
+  uint32_t startingSpeed = 0;
+  uint32_t maxSpeed = 0;
+  uint32_t maxAccel = 0;
+  uint32_t maxDecel = 0;
+  double position = 0;
+  double velocity = 0;
+  uint64_t lastStepTime = 0;
+  uint8_t stepMode = 0;
+  uint8_t currentLimit = 0;
+  uint8_t decayMode = 0;
+  uint8_t agc[4] = {};
+  uint32_t commandCount = 0;
+
+  // Serial parser
+  uint8_t frame[TicMaxFrameLength];
+  uint8_t frameLength = 0;
+
+  // I2C read request
+  uint8_t i2cReadCmd = 0;
+  uint8_t i2cReadOffset = 0;
+};
+
+/// A simulated serial bus.  The library writes to it as if it were the
+/// serial port connected to the Tics' RX lines, and reads the Tics'
+/// responses from it.
+///
+/// Each byte takes 10 bit times at the baud rate.  Writes are buffered like
+/// a hardware serial port, and block once the transmit buffer is full.  Each
+/// Tic starts responding after the configured latency.
+class TicSimSerialBus : public Stream
+{
+public:
+  TicSimSerialBus(TicSim & sim, uint32_t baudRate = 9600);
+  ~TicSimSerialBus();
+
+  void attach(TicSimDevice & device);
+
+  void setBaudRate(uint32_t baudRate) { this->baudRate = baudRate; }
+  uint32_t getBaudRate() const { return baudRate; }
+
+  /// Sets the time from the end of a read command to the start of the
+  /// response, in microseconds.  The default is 20 us.
+  void setLatency(uint32_t latency) { this->latency = latency; }
+
+  /// Sets the size of the transmit buffer, in bytes.  The default is 64,
+  /// like the AVR Arduino core.
+  void setTxBufferSize(uint16_t size) { txBufferSize = size; }
+
+  /// Sets how much virtual time passes when available() finds nothing to
+  /// read, which models the CPU time of a polling loop.  The default is
+  /// 10 us.
+  void setPollTime(uint32_t time) { pollTime = time; }
+
+  uint64_t getBytesWritten() const { return bytesWritten; }
+  uint64_t getBytesRead() const { return bytesRead; }
+
+  /// Returns the time in microseconds at which the last byte written will
+  /// have been received by the Tics.
+  uint64_t getTxIdleTime() const { return txFree; }
+
+  size_t write(uint8_t byte) override;
+  using Print::write;
+  int available() override;
+  int read() override;
+  int peek() override;
+  int availableForWrite() override;
+
+private:
+  struct TimedByte
+  {
+    uint64_t time;
+    uint8_t byte;
+  };
+
+  uint64_t byteTime() const { return 10000000 / baudRate; }
+  bool nextEventTime(uint64_t & time);
+  void processEvents(uint64_t time);
+  int arrivedCount();
+
+  TicSim & sim;
+  std::vector<TicSimDevice *> devices;
+  uint32_t baudRate;
+  uint32_t latency = 20;
+  uint16_t txBufferSize = 64;
+  uint32_t pollTime = 10;
+  std::deque<TimedByte> tx;
+  std::deque<TimedByte> rx;
+  uint64_t txFree = 0;
+  uint64_t rxFree = 0;
+  uint64_t bytesWritten = 0;
+  uint64_t bytesRead = 0;
+
+  friend class TicSim;
+};
+
+/// A simulated I2C bus.  Install it with `Wire.setBackend()`.  Each
+/// transaction blocks for the time it takes at the configured clock speed.
+class TicSimI2CBus : public TwoWireBackend
+{
+public:
+  TicSimI2CBus(TicSim & sim, uint32_t clock = 100000);
+  ~TicSimI2CBus();
+
+  void attach(TicSimDevice & device);
+
+  void setClock(uint32_t clock) { this->clock = clock; }
+  uint32_t getClock() const { return clock; }
+
+  uint64_t getTransactions() const { return transactions; }
+
+  uint8_t write(uint8_t address, const uint8_t * data, uint8_t length,
+    bool sendStop) override;
+  uint8_t read(uint8_t address, uint8_t * data, uint8_t length,
+    bool sendStop) override;
+
+private:
+  TicSimDevice * find(uint8_t address);
+  void transfer(uint8_t length);
+
+  TicSim & sim;
+  std::vector<TicSimDevice *> devices;
+  uint32_t clock;
+  uint64_t transactions = 0;
+};
+
+/// The simulation: virtual time and the devices and buses that live in it.
+/// Creating a TicSim makes it the HostClock, and destroying it restores the
+/// host's clock.
+class TicSim : public HostClock
+{
+public:
+  TicSim();
+  ~TicSim();
+
+  uint64_t now() override { return time; }
+  void waitUntil(uint64_t time) override { advanceTo(time); }
+
+  /// Advances to the next byte arriving on a serial bus, or by 100 us if
+  /// there is none.
+  void idle() override;
+
+  /// Runs the simulation up to the specified time in microseconds.
+  void advanceTo(uint64_t time);
+
+private:
+  void addDevice(TicSimDevice * device);
+
+  uint64_t time = 0;
+  std::vector<TicSimDevice *> devices;
+  std::vector<TicSimSerialBus *> serialBuses;
+
+  friend class TicSimSerialBus;
+  friend class TicSimI2CBus;
+};
@@ -0,0 +1,321 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+// Checks the library's helper classes against simulated Tics in virtual
+// time, including cases that are slow or awkward to set up with hardware,
+// like a millis() value that has run for minutes.  It prints what it checked
+// and exits with a non-zero status if anything failed.
+//
+// Usage: tic_sim_checks
+
+#include <TicSim.h>
+#include <stdio.h>
+
+static int failures = 0;
+
+static void check(bool condition, const char * what)
+{
+  printf("%s: %s\n", condition ? "ok" : "FAILED", what);
+  if (!condition) { failures++; }
+}
+
+static bool hasCommandTimeout(TicSimDevice & device)
+{
+  return device.getErrorStatus() & (1 << (uint8_t)TicError::CommandTimeout);
+}
+
+// Runs the keepalive for the specified time and returns true if the device
+// never reported a command timeout.
+static bool keepAlive(TicKeepalive & keepalive, TicSimDevice & device,
+  uint32_t ms)
+{
+  bool ok = true;
+  uint32_t start = millis();
+  while ((uint32_t)(millis() - start) < ms)
+  {
+    keepalive.update();
+    delay(1);
+    if (hasCommandTimeout(device)) { ok = false; }
+  }
+  return ok;
+}
+
+static void checkKeepalive()
+{
+  TicSim sim;
+  TicSimSerialBus bus(sim, 115200);
+  TicSimDevice device1(1), device2(2);
+  bus.attach(device1);
+  bus.attach(device2);
+  TicSerial tic1(bus, 1), tic2(bus, 2);
+
+  // Start well past the point where the 16-bit command times wrap, with one
+  // Tic never commanded and one commanded long ago.
+  sim.advanceTo(60000000);
+  tic2.exitSafeStart();
+  sim.advanceTo(100000000);
+
+  TicKeepalive keepalive(500);
+  TicKeepaliveEntry entry1(tic1), entry2(tic2);
+  keepalive.add(entry1);
+  keepalive.add(entry2);
+
+  uint32_t count1 = device1.getCommandCount();
+  uint32_t count2 = device2.getCommandCount();
+  keepAlive(keepalive, device1, 100);
+  check(device1.getCommandCount() > count1,
+    "keepalive resets a Tic that was never commanded");
+  check(device2.getCommandCount() > count2,
+    "keepalive resets a Tic commanded 40 s ago");
+
+  check(keepAlive(keepalive, device1, 5000) && !hasCommandTimeout(device2),
+    "keepalive prevents command timeouts after millis() wraps");
+
+  // A Tic that is receiving other commands needs no resets.
+  tic1.exitSafeStart();
+  delay(10);
+  count1 = device1.getCommandCount();
+  uint32_t start = millis();
+  while ((uint32_t)(millis() - start) < 2000)
+  {
+    tic1.exitSafeStart();
+    keepalive.update();
+    delay(100);
+  }
+  check(device1.getCommandCount() - count1 == 20,
+    "keepalive skips a Tic receiving other commands");
+
+  // Intervals of 32768 ms or more are clamped to TicMaxKeepaliveInterval.
+  device1.setCommandTimeout(40000);
+  device1.powerUp();
+  tic1.exitSafeStart();
+  TicKeepalive slowKeepalive(40000);
+  TicKeepaliveEntry slowEntry(tic1);
+  slowKeepalive.add(slowEntry);
+  delay(10);
+  count1 = device1.getCommandCount();
+  bool ok = true;
+  start = millis();
+  while ((uint32_t)(millis() - start) < 120000)
+  {
+    slowKeepalive.update();
+    delay(10);
+    if (hasCommandTimeout(device1)) { ok = false; }
+  }
+  uint32_t resets = device1.getCommandCount() - count1;
+  check(ok && resets >= 3 && resets <= 4,
+    "keepalive clamps long intervals to TicMaxKeepaliveInterval");
+}
+
+static void checkGroup()
+{
+  TicSim sim;
+  TicSimSerialBus bus(sim, 115200);
+  TicSimDevice device1(1), device2(2);
+  bus.attach(device1);
+  bus.attach(device2);
+  TicSerial tic1(bus, 1), tic2(bus, 2);
+  TicSerial * members[] = { &tic1, &tic2 };
+  TicSerialGroup group(bus, members, 2);
+
+  sim.advanceTo(100000000);
+  group.exitSafeStart();
+  uint16_t sent = millis();
+  check(tic1.getLastCommandTime() == sent && tic2.getLastCommandTime() == sent,
+    "group broadcast records the command time for each member");
+
+  TicKeepalive keepalive(500);
+  TicKeepaliveEntry entry1(tic1);
+  keepalive.add(entry1);
+  delay(10);
+  uint32_t count = device1.getCommandCount();
+  uint32_t start = millis();
+  while ((uint32_t)(millis() - start) < 2000)
+  {
+    group.resetCommandTimeout();
+    keepalive.update();
+    delay(100);
+  }
+  check(device1.getCommandCount() - count == 20,
+    "keepalive skips a Tic receiving group broadcasts");
+}
+
+// Sends the same target velocity every 10 ms for the specified time and
+// returns true if the device never reported a command timeout.
+static bool repeatVelocity(TicSerial & tic, TicSimDevice & device,
+  uint32_t ms)
+{
+  bool ok = true;
+  uint32_t start = millis();
+  while ((uint32_t)(millis() - start) < ms)
+  {
+    tic.setTargetVelocity(1000000);
+    delay(10);
+    if (hasCommandTimeout(device)) { ok = false; }
+  }
+  return ok;
+}
+
+static void checkShadow()
+{
+  TicSim sim;
+  TicSimSerialBus bus(sim, 115200);
+  TicSimDevice device(1);
+  bus.attach(device);
+  TicSerial tic(bus, 1);
+  TicCommandShadow shadow;
+  tic.setCommandShadow(&shadow);
+
+  sim.advanceTo(100000000);
+  tic.exitSafeStart();
+  check(repeatVelocity(tic, device, 5000) && device.getVelocity() != 0,
+    "shadow refreshes a repeated target before the command timeout");
+  check(shadow.getSkipped() > 400 && shadow.getSent() <= 11,
+    "shadow skips most repeated targets");
+
+  shadow.setRefreshInterval(0);
+  check(!repeatVelocity(tic, device, 5000),
+    "shadow without refresh lets the command timeout expire");
+
+  TicKeepalive keepalive(500);
+  TicKeepaliveEntry entry(tic);
+  keepalive.add(entry);
+  tic.exitSafeStart();
+  bool ok = true;
+  uint32_t start = millis();
+  while ((uint32_t)(millis() - start) < 5000)
+  {
+    tic.setTargetVelocity(1000000);
+    keepalive.update();
+    delay(10);
+    if (hasCommandTimeout(device)) { ok = false; }
+  }
+  check(ok && device.getVelocity() != 0,
+    "shadow without refresh works with TicKeepalive");
+}
+
+static void checkScheduler()
+{
+  TicSim sim;
+  TicSimSerialBus bus(sim, 115200);
+  TicSimDevice device(1);
+  bus.attach(device);
+  TicSerial tic(bus, 1);
+
+  tic.exitSafeStart();
+  tic.setTargetVelocity(1000000);
+  delay(100);
+
+  TicWorkItem items[4];
+  TicScheduler scheduler(items, 4);
+  check(!scheduler.read(TicPriority::Telemetry, tic, TicCommand::GetVariable,
+    0x22, 4, nullptr) && scheduler.getCount() == 0,
+    "scheduler refuses a read without a buffer");
+
+  uint8_t buffers[4][4];
+  uint8_t status[4];
+  bool queued = true;
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    queued = queued && scheduler.read(TicPriority::Telemetry, tic,
+      TicCommand::GetVariable, 0x22, 4, buffers[i], 0, &status[i]);
+  }
+  check(queued && !scheduler.read(TicPriority::Telemetry, tic,
+    TicCommand::GetVariable, 0x22, 4, buffers[0]),
+    "scheduler fills up with telemetry reads");
+
+  check(scheduler.halt(tic) && status[3] == TicWorkExpired &&
+    status[0] == TicWorkPending && status[2] == TicWorkPending &&
+    scheduler.getEvicted() == 1 && scheduler.getExpired() == 0,
+    "halt evicts the newest telemetry read when the scheduler is full");
+
+  uint32_t count = device.getCommandCount();
+  scheduler.update();
+  delay(10);
+  check(device.getCommandCount() == count + 1 && device.getVelocity() == 0 &&
+    status[0] == TicWorkPending,
+    "evicting halt is sent on the next update");
+
+  for (uint8_t i = 0; i < 4; i++) { scheduler.halt(tic); }
+  check(!scheduler.halt(tic) && scheduler.getEvicted() == 4,
+    "halt never evicts another halt");
+  while (scheduler.update()) {}
+
+  // Timeouts of 32768 ms or more used to look like they had already passed.
+  uint8_t longStatus;
+  scheduler.read(TicPriority::Telemetry, tic, TicCommand::GetVariable,
+    0x22, 4, buffers[0], 40000, &longStatus);
+  scheduler.update();
+  check(longStatus == 0, "scheduler sends work with a 40 s timeout");
+}
+
+static void checkCommandQueue()
+{
+  TicSim sim;
+  TicSimSerialBus bus(sim, 115200);
+  TicSimDevice device(1);
+  bus.attach(device);
+  TicSerial tic(bus, 1);
+  TicQueuedCommand buffer[4];
+  TicCommandQueue queue(tic, buffer, 4);
+  queue.setInterval(10000);
+
+  sim.advanceTo(100000000);
+  queue.setTargetVelocity(1000);
+  bool first = queue.update();
+  queue.setTargetVelocity(2000);
+  bool early = queue.update();
+
+  // 70 ms is more than 65.536 ms, where a 16-bit microsecond time wraps.
+  delay(70);
+  check(first && !early && queue.update(),
+    "command queue sends a command that has waited longer than 65 ms");
+}
+
+static void checkSerialBus()
+{
+  TicSim sim;
+  TicSimSerialBus bus(sim, 115200);
+  TicSimDevice device1(1), device2(2);
+  bus.attach(device1);
+  bus.attach(device2);
+  TicSerialBus ticBus(bus);
+  const TicHandle tic1(1), tic2(2);
+
+  ticBus[tic1].haltAndSetPosition(1111);
+  ticBus[tic2].haltAndSetPosition(2222);
+
+  int32_t position1 = 0;
+  ticBus[tic1].beginGetVariable(0x22, 4, &position1);
+  TicSerial & tic = ticBus[tic2];
+  check(!tic.isRequestPending() && tic.getLastError() == 0 &&
+    position1 == 1111,
+    "selecting another Tic finishes the pending read");
+
+  int32_t position2 = tic.getCurrentPosition();
+  check(position2 == 2222, "bus reads the newly selected Tic");
+
+  // A finished request's error must not come back after a later success.
+  const TicHandle absent(3);
+  ticBus[absent].beginGetVariable(0x22, 4, &position1);
+  while (!tic.poll()) { delay(1); }
+  uint8_t timeoutError = tic.getLastError();
+  ticBus[tic1].getCurrentPosition();
+  tic.poll();
+  TicSerialRequest queue[2];
+  tic.setRequestQueue(queue, 2);
+  check(timeoutError == 50 && tic.getLastError() == 0,
+    "idle poll() keeps the error from the last communication");
+}
+
+int main()
+{
+  checkKeepalive();
+  checkGroup();
+  checkShadow();
+  checkScheduler();
+  checkCommandQueue();
+  checkSerialBus();
+
+  printf(failures ? "%d checks failed\n" : "all checks passed\n", failures);
+  return failures ? 1 : 0;
+}
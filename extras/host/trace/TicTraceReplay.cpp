@@ -0,0 +1,501 @@
+// Copyright (C) Pololu Corporation.  See LICENSE.txt for details.
+
+// Replays a trace recorded with TicTraceBuffer::dump() through the library.
+//
+// Each command or read in the trace is decoded and issued again with a
+// TicSerial or TicI2C object, in virtual time that follows the trace: the
+// call starts at the recorded time, and each recorded response arrives at
+// its recorded time.  The program prints one row per call with what was
+// decoded, the data the library read, the library's error code, and whether
+// the library sent the same bytes as in the trace.  A "no" in the match
+// column means the library now encodes that call differently.
+//
+// Usage: tic_trace_replay [-c] [-C] [-f csv|tsv] trace.bin
+//
+//   -c  The serial commands in the trace have CRC bytes.
+//   -C  The serial responses in the trace have CRC bytes.
+
+#include <Tic.h>
+#include <deque>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct Record
+{
+  uint8_t flags;
+  uint64_t time;
+  std::vector<uint8_t> data;
+};
+
+struct TimedByte
+{
+  uint64_t time;
+  uint8_t byte;
+};
+
+static bool loadTrace(FILE * file, std::vector<Record> & records)
+{
+  std::vector<uint8_t> bytes;
+  int c;
+  while ((c = fgetc(file)) != EOF) { bytes.push_back(c); }
+
+  static const uint8_t magic[] = { 'T', 'i', 'c', 'T', 1 };
+  if (bytes.size() < sizeof(magic) || memcmp(bytes.data(), magic, 5))
+  {
+    return false;
+  }
+
+  uint64_t time = 0;
+  size_t i = sizeof(magic);
+  while (i < bytes.size())
+  {
+    Record r;
+    r.flags = bytes[i] & ~TicTraceMaxData;
+    uint8_t length = bytes[i++] & TicTraceMaxData;
+
+    uint64_t delta = 0;
+    uint8_t shift = 0;
+    while (true)
+    {
+      if (i >= bytes.size()) { return false; }
+      uint8_t b = bytes[i++];
+      delta |= (uint64_t)(b & 0x7F) << shift;
+      shift += 7;
+      if (!(b & 0x80)) { break; }
+    }
+    if (records.size()) { time += delta; }
+    r.time = time;
+
+    if (i + length > bytes.size()) { return false; }
+    r.data.assign(bytes.begin() + i, bytes.begin() + i + length);
+    i += length;
+    records.push_back(r);
+  }
+  return true;
+}
+
+/// Virtual time for the replay.  While the library waits for serial input,
+/// time skips ahead to the next response byte.
+class ReplayClock : public HostClock
+{
+public:
+  uint64_t now() override { return time; }
+  void waitUntil(uint64_t t) override { if (t > time) { time = t; } }
+  void idle() override;
+
+  uint64_t time = 0;
+  std::deque<TimedByte> * rx = nullptr;
+};
+
+/// A serial port that records what the library writes and plays back the
+/// responses from the trace.
+class ReplayStream : public Stream
+{
+public:
+  ReplayStream(ReplayClock & clock) : clock(clock) { clock.rx = &rx; }
+
+  size_t write(uint8_t byte) override
+  {
+    written.push_back(byte);
+    return 1;
+  }
+
+  int available() override
+  {
+    int count = 0;
+    for (const TimedByte & b : rx)
+    {
+      if (b.time > clock.time) { break; }
+      count++;
+    }
+    return count;
+  }
+
+  int read() override
+  {
+    if (rx.empty() || rx.front().time > clock.time) { return -1; }
+    uint8_t byte = rx.front().byte;
+    rx.pop_front();
+    return byte;
+  }
+
+  int peek() override
+  {
+    if (rx.empty() || rx.front().time > clock.time) { return -1; }
+    return rx.front().byte;
+  }
+
+  ReplayClock & clock;
+  std::vector<uint8_t> written;
+  std::deque<TimedByte> rx;
+};
+
+void ReplayClock::idle()
+{
+  if (rx && !rx->empty() && rx->front().time > time)
+  {
+    time = rx->front().time;
+  }
+  else
+  {
+    time += 100;
+  }
+}
+
+/// An I2C bus that records what the library writes and plays back the read
+/// data from the trace.
+class ReplayI2C : public TwoWireBackend
+{
+public:
+  ReplayI2C(ReplayClock & clock) : clock(clock) { }
+
+  uint8_t write(uint8_t address, const uint8_t * data, uint8_t length,
+    bool sendStop) override
+  {
+    (void)sendStop;
+    written.push_back(address);
+    written.insert(written.end(), data, data + length);
+    return 0;
+  }
+
+  uint8_t read(uint8_t address, uint8_t * data, uint8_t length,
+    bool sendStop) override
+  {
+    (void)address;
+    (void)sendStop;
+    if (!response) { return 0; }
+    clock.waitUntil(response->time);
+
+    // The first byte of the record is the address.
+    uint8_t count = response->data.size() - 1;
+    if (count > length) { count = length; }
+    memcpy(data, response->data.data() + 1, count);
+    response = nullptr;
+    return count;
+  }
+
+  ReplayClock & clock;
+  std::vector<uint8_t> written;
+  const Record * response = nullptr;
+};
+
+static const char * commandName(uint8_t cmd)
+{
+  switch ((TicCommand)cmd)
+  {
+  case TicCommand::SetTargetPosition: return "SetTargetPosition";
+  case TicCommand::SetTargetVelocity: return "SetTargetVelocity";
+  case TicCommand::HaltAndSetPosition: return "HaltAndSetPosition";
+  case TicCommand::HaltAndHold: return "HaltAndHold";
+  case TicCommand::GoHome: return "GoHome";
+  case TicCommand::ResetCommandTimeout: return "ResetCommandTimeout";
+  case TicCommand::Deenergize: return "Deenergize";
+  case TicCommand::Energize: return "Energize";
+  case TicCommand::ExitSafeStart: return "ExitSafeStart";
+  case TicCommand::EnterSafeStart: return "EnterSafeStart";
+  case TicCommand::Reset: return "Reset";
+  case TicCommand::ClearDriverError: return "ClearDriverError";
+  case TicCommand::SetSpeedMax: return "SetSpeedMax";
+  case TicCommand::SetStartingSpeed: return "SetStartingSpeed";
+  case TicCommand::SetAccelMax: return "SetAccelMax";
+  case TicCommand::SetDecelMax: return "SetDecelMax";
+  case TicCommand::SetStepMode: return "SetStepMode";
+  case TicCommand::SetCurrentLimit: return "SetCurrentLimit";
+  case TicCommand::SetDecayMode: return "SetDecayMode";
+  case TicCommand::SetAgcOption: return "SetAgcOption";
+  case TicCommand::GetVariable: return "GetVariable";
+  case TicCommand::GetVariableAndClearErrorsOccurred:
+    return "GetVariableAndClearErrorsOccurred";
+  case TicCommand::GetSetting: return "GetSetting";
+  default: return "Unknown";
+  }
+}
+
+// Returns the number of data bytes after a command byte in the serial
+// protocol, or -1 if the command is not valid.
+static int serialDataLength(uint8_t cmd)
+{
+  switch (cmd >> 4)
+  {
+  case 0x8: case 0xB: return 0;
+  case 0x9: return 1;
+  case 0xA: return 2;
+  case 0xE: return 5;
+  default: return -1;
+  }
+}
+
+/// One decoded command or read.
+struct Call
+{
+  uint8_t device = 255;
+  uint8_t cmd = 0;
+  uint32_t val = 0;
+  uint8_t offset = 0;
+  uint8_t length = 0;
+  bool isRead() const { return (cmd >> 4) == 0xA; }
+};
+
+// Decodes a serial frame at the start of the data.  Returns its length, or 0
+// if it is not a valid frame.
+static size_t decodeSerial(const uint8_t * data, size_t size, bool crc,
+  Call & call)
+{
+  size_t header = 1;
+  if (size >= 3 && data[0] == 0xAA)
+  {
+    call.device = data[1];
+    call.cmd = data[2] | 0x80;
+    header = 3;
+  }
+  else if (size >= 1)
+  {
+    call.device = 255;
+    call.cmd = data[0];
+  }
+  else
+  {
+    return 0;
+  }
+
+  int dataLength = serialDataLength(call.cmd);
+  if (dataLength < 0) { return 0; }
+  size_t length = header + dataLength + crc;
+  if (length > size) { return 0; }
+
+  const uint8_t * d = data + header;
+  if (dataLength == 1)
+  {
+    call.val = d[0];
+  }
+  else if (dataLength == 2)
+  {
+    call.offset = d[0] | (d[1] & 0x40) << 1;
+    call.length = d[1] & 0x3F;
+  }
+  else if (dataLength == 5)
+  {
+    call.val = (uint32_t)(d[1] | (d[0] << 7 & 0x80)) |
+      (uint32_t)(d[2] | (d[0] << 6 & 0x80)) << 8 |
+      (uint32_t)(d[3] | (d[0] << 5 & 0x80)) << 16 |
+      (uint32_t)(d[4] | (d[0] << 4 & 0x80)) << 24;
+  }
+  return length;
+}
+
+static bool decodeI2C(const std::vector<uint8_t> & data,
+  const Record * response, Call & call)
+{
+  if (data.size() < 2) { return false; }
+  call.device = data[0];
+  call.cmd = data[1];
+  const uint8_t * d = data.data() + 2;
+  switch (data.size() - 2)
+  {
+  case 0:
+    break;
+  case 1:
+    if (call.isRead())
+    {
+      call.offset = d[0];
+      call.length = response ? response->data.size() - 1 : 0;
+    }
+    else
+    {
+      call.val = d[0];
+    }
+    break;
+  case 4:
+    call.val = (uint32_t)d[0] | (uint32_t)d[1] << 8 |
+      (uint32_t)d[2] << 16 | (uint32_t)d[3] << 24;
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
+
+// Issues a decoded call through the library.
+static uint8_t issue(TicBase & tic, const Call & call, uint8_t * buffer)
+{
+  if (call.isRead())
+  {
+    tic.readBlock((TicCommand)call.cmd, call.offset, call.length, buffer);
+  }
+  else
+  {
+    tic.sendCommand((TicCommand)call.cmd, call.val);
+  }
+  return tic.getLastError();
+}
+
+static char separator = '\t';
+
+static void printRow(uint64_t time, uint64_t elapsed, const char * bus,
+  const Call & call, const uint8_t * buffer, uint8_t error, const char * match)
+{
+  std::string arg, response;
+  char text[32];
+  if (call.isRead())
+  {
+    snprintf(text, sizeof(text), "0x%02X+%u", call.offset, call.length);
+    arg = text;
+    for (uint8_t i = 0; i < call.length; i++)
+    {
+      snprintf(text, sizeof(text), "%02x", buffer[i]);
+      response += text;
+    }
+  }
+  else if (serialDataLength(call.cmd) > 0)
+  {
+    snprintf(text, sizeof(text), "%ld", (long)(int32_t)call.val);
+    arg = text;
+  }
+
+  printf("%llu%c%llu%c%s%c%u%c%s%c%s%c%s%c%u%c%s\n",
+    (unsigned long long)time, separator, (unsigned long long)elapsed,
+    separator, bus, separator, call.device, separator,
+    commandName(call.cmd), separator, arg.c_str(), separator,
+    response.c_str(), separator, error, separator, match);
+}
+
+int main(int argc, char ** argv)
+{
+  bool crcForCommands = false;
+  bool crcForResponses = false;
+  const char * path = nullptr;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-c")) { crcForCommands = true; }
+    else if (!strcmp(argv[i], "-C")) { crcForResponses = true; }
+    else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+    {
+      separator = strcmp(argv[++i], "csv") ? '\t' : ',';
+    }
+    else if (!path) { path = argv[i]; }
+    else { path = nullptr; break; }
+  }
+  if (!path)
+  {
+    fprintf(stderr,
+      "usage: tic_trace_replay [-c] [-C] [-f csv|tsv] trace.bin\n");
+    return 2;
+  }
+
+  FILE * file = fopen(path, "rb");
+  if (!file)
+  {
+    perror(path);
+    return 1;
+  }
+  std::vector<Record> records;
+  bool valid = loadTrace(file, records);
+  fclose(file);
+  if (!valid)
+  {
+    fprintf(stderr, "%s: not a valid Tic trace\n", path);
+    return 1;
+  }
+
+  ReplayClock clock;
+  hostSetClock(&clock);
+  ReplayStream stream(clock);
+  ReplayI2C i2c(clock);
+  Wire.setBackend(&i2c);
+
+  printf("time_us%celapsed_us%cbus%cdevice%ccommand%cargument%cresponse%c"
+    "error%cmatch\n", separator, separator, separator, separator, separator,
+    separator, separator, separator);
+
+  uint32_t mismatches = 0;
+  for (size_t i = 0; i < records.size(); i++)
+  {
+    const Record & out = records[i];
+    if (out.flags & TicTraceReceived)
+    {
+      // A response with no request before it, probably because the request
+      // was dropped from the ring buffer.
+      continue;
+    }
+
+    // Gather the responses that follow this record.
+    std::vector<const Record *> responses;
+    for (size_t j = i + 1; j < records.size(); j++)
+    {
+      if (!(records[j].flags & TicTraceReceived)) { break; }
+      if ((records[j].flags & TicTraceI2C) == (out.flags & TicTraceI2C))
+      {
+        responses.push_back(&records[j]);
+      }
+    }
+
+    uint8_t buffer[TicTraceMaxData];
+    memset(buffer, 0, sizeof(buffer));
+    clock.waitUntil(out.time);
+
+    if (out.flags & TicTraceI2C)
+    {
+      Call call;
+      const Record * response = responses.empty() ? nullptr : responses[0];
+      if (!decodeI2C(out.data, response, call)) { continue; }
+
+      TicI2C tic(call.device);
+      i2c.written.clear();
+      i2c.response = response;
+      uint64_t start = clock.time;
+      uint8_t error = issue(tic, call, buffer);
+
+      // For a read, the trace only has the request that goes out before the
+      // repeated start.
+      bool match = i2c.written == out.data;
+      if (!match) { mismatches++; }
+      printRow(start, clock.time - start, "i2c", call, buffer, error,
+        match ? "yes" : "no");
+      continue;
+    }
+
+    // A serial record can hold several frames if they were written at once,
+    // for example by TicSerialBatch.
+    const uint8_t * data = out.data.data();
+    size_t size = out.data.size();
+    while (size)
+    {
+      Call call;
+      size_t length = decodeSerial(data, size, crcForCommands, call);
+      if (length == 0) { break; }
+
+      TicSerial tic(stream, call.device);
+      tic.setCrcForCommands(crcForCommands);
+      tic.setCrcForResponses(crcForResponses);
+      stream.written.clear();
+      stream.rx.clear();
+      if (call.isRead())
+      {
+        for (const Record * r : responses)
+        {
+          for (uint8_t byte : r->data) { stream.rx.push_back({ r->time, byte }); }
+        }
+        responses.clear();
+      }
+
+      uint64_t start = clock.time;
+      uint8_t error = issue(tic, call, buffer);
+
+      bool match = stream.written.size() == length &&
+        !memcmp(stream.written.data(), data, length);
+      if (!match) { mismatches++; }
+      printRow(start, clock.time - start, "serial", call, buffer, error,
+        match ? "yes" : "no");
+
+      data += length;
+      size -= length;
+    }
+  }
+
+  Wire.setBackend(nullptr);
+  hostSetClock(nullptr);
+  return mismatches ? 3 : 0;
+}